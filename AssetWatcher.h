@@ -0,0 +1,88 @@
+// Polls the size & modification time of the files a model was loaded from, so edited assets
+// can be reloaded while the renderer keeps running. Only the file attributes are read.
+#ifndef ASSET_WATCHER_H
+#define ASSET_WATCHER_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+#include <string>
+#include <vector>
+
+struct AssetStamp
+{
+	long long size = -1; // -1 while the file is missing
+	long long modified = 0; // in the platform's finest unit, saves within a second still differ
+
+	bool operator!=(const AssetStamp& other) const { return size != other.size || modified != other.modified; }
+};
+
+AssetStamp GetAssetStamp(const std::string& path)
+{
+	AssetStamp stamp;
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &info))
+	{
+		stamp.size = (static_cast<long long>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+		stamp.modified = (static_cast<long long>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+	}
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) == 0)
+	{
+		stamp.size = static_cast<long long>(info.st_size);
+#ifdef __APPLE__
+		stamp.modified = static_cast<long long>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+		stamp.modified = static_cast<long long>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+	}
+#endif
+	return stamp;
+}
+
+class AssetWatcher
+{
+	std::vector<std::string> paths;
+	std::vector<AssetStamp> stamps;
+	int changed = -1; // file that changed on an earlier poll, reported once it stops changing
+
+public:
+	// Replaces the watched files, their current state is the baseline
+	void Watch(const std::vector<std::string>& _paths)
+	{
+		paths = _paths;
+		stamps.resize(paths.size());
+		for (size_t i = 0; i < paths.size(); ++i)
+			stamps[i] = GetAssetStamp(paths[i]);
+		changed = -1;
+	}
+
+	// True when a file changed and then stayed the same for a whole poll, so a save that writes the
+	// file in several steps (or a missing file that is being replaced) triggers a single reload
+	bool Poll(std::string& changedPath)
+	{
+		bool changing = false;
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			AssetStamp stamp = GetAssetStamp(paths[i]);
+			if (stamp != stamps[i])
+			{
+				stamps[i] = stamp;
+				changed = static_cast<int>(i);
+				changing = true;
+			}
+		}
+		if (changing || changed < 0 || stamps[changed].size < 0)
+			return false;
+
+		changedPath = paths[changed];
+		changed = -1;
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,45 @@
+// Requires Gateware (SYSTEM)
+// Where the renderer keeps data it can always rebuild (compiled shaders, pipeline caches...)
+#ifndef CACHE_FOLDER_H
+#define CACHE_FOLDER_H
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Creates "path" if it doesn't exist yet, returns false if it still isn't there
+bool EnsureFolder(const std::string& path)
+{
+#ifdef _WIN32
+	_mkdir(path.c_str());
+	struct _stat info;
+	return _stat(path.c_str(), &info) == 0 && (info.st_mode & _S_IFDIR);
+#else
+	mkdir(path.c_str(), 0755);
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+// GFile's cache folder plus "subFolder", created on demand and returned with a trailing slash.
+// Returns an empty string when nothing can be cached, callers then just skip their cache.
+std::string GetCacheSubFolder(const char* subFolder)
+{
+	char folder[260] = {};
+	GW::SYSTEM::GFile file;
+	if (-file.Create() || -file.GetCacheFolder(sizeof(folder), folder) || folder[0] == '\0')
+		return std::string();
+
+	std::string path = folder;
+	if (!EnsureFolder(path))
+		return std::string();
+	path += "/";
+	path += subFolder;
+	if (!EnsureFolder(path))
+		return std::string();
+	return path + "/";
+}
+
+#endif
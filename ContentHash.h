@@ -0,0 +1,33 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+// 64 bit FNV-1a, used to key on-disk caches by the exact bytes they were built from
+const uint64_t CONTENT_HASH_SEED = 0xCBF29CE484222325ull;
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = CONTENT_HASH_SEED)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+uint64_t HashString(const std::string& text, uint64_t hash = CONTENT_HASH_SEED)
+{
+	return HashBytes(text.data(), text.size(), hash);
+}
+
+// Hashes a whole file through a read-only mapping, returns false if it can't be opened
+bool HashFile(const std::string& filePath, uint64_t& outHash)
+{
+	MappedFile file;
+	if (!file.Open(filePath.c_str()))
+		return false;
+	outHash = HashBytes(file.Data(), file.Size());
+	return true;
+}
+
+#endif
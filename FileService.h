@@ -0,0 +1,84 @@
+// Requires Gateware (SYSTEM) & MappedFile.h
+// How the loaders read files. A FileView is a shared read-only mapping: large binaries are never
+// copied onto the heap, and whatever still points into one keeps it open. FileService reads batches of
+// files on the Gateware thread pool, mapping each one and faulting its pages in so the thread that
+// uses it never waits on the disk, then hands every file to a completion callback.
+#ifndef FILE_SERVICE_H
+#define FILE_SERVICE_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef std::shared_ptr<const MappedFile> FileView;
+
+// Maps "filePath", null when it can't be opened or is empty
+FileView OpenFileView(const std::string& filePath)
+{
+	std::shared_ptr<MappedFile> file(new MappedFile());
+	if (!file->Open(filePath.c_str()))
+		return FileView();
+	return file;
+}
+
+// Touches a byte of every page, so reading the view afterwards doesn't fault
+void PrefetchFileView(const MappedFile& file)
+{
+	const size_t PAGE_SIZE_BYTES = 4096;
+	unsigned char touched = 0;
+	for (size_t offset = 0; offset < file.Size(); offset += PAGE_SIZE_BYTES)
+		touched ^= reinterpret_cast<const volatile unsigned char*>(file.Data())[offset];
+	(void)touched;
+}
+
+struct FileRead
+{
+	std::string path;
+	size_t index; // of path in its batch
+	FileView view; // null when the file couldn't be opened
+};
+
+typedef std::function<void(const FileRead&)> FileReadCallback;
+
+class FileService
+{
+	GW::SYSTEM::GConcurrent tasks;
+	bool threaded = false;
+
+public:
+	FileService() { threaded = +tasks.Create(true); }
+	FileService(const FileService&) = delete;
+	FileService& operator=(const FileService&) = delete;
+	~FileService() { Wait(); }
+
+	// Reads every file of "paths" as a task of its own. "callback" runs on the worker that read the file,
+	// so it may only touch what belongs to that file. Without a thread pool the files are read right here.
+	// Nothing waits on the batch until Wait(), so it overlaps with whatever the caller does next.
+	void ReadBatch(const std::vector<std::string>& paths, FileReadCallback callback)
+	{
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			std::string path = paths[i];
+			auto read = [path, i, callback]()
+			{
+				FileRead file = { path, i, OpenFileView(path) };
+				if (file.view)
+					PrefetchFileView(*file.view);
+				callback(file);
+			};
+			if (!threaded || -tasks.BranchSingular(read))
+				read();
+		}
+	}
+
+	// Returns once every file read so far went through its callback. Waits for the pool, so it must not be
+	// called from inside a pool job.
+	void Wait()
+	{
+		if (threaded)
+			tasks.Converge(0);
+	}
+};
+
+#endif
@@ -21,7 +21,21 @@ cbuffer UboView : register(b0)
     SHADER_VARS ubo;
 }
 
-static float4 diffuse = float4(0.75f, 0.75f, 0.25f, 0);
+// same block as VertexShader.hlsl
+struct MESH_VARS
+{
+    float4x4 worldMatrix;
+    float4 dequantScale;
+    float4 dequantOffset;
+    float4 baseColorFactor;
+};
+
+[[vk::push_constant]] MESH_VARS mesh;
+
+// the draw's material, a missing base color image is bound to a white texture
+[[vk::binding(0, 1)]] SamplerState materialSampler;
+[[vk::binding(1, 1)]] Texture2D baseColorTexture;
+
 static float4 specular = float4(1, 1, 1, 1);
 static float4 ambient = float4(0.1f, 0.1f, 0.1f, 1);
 static float4 emissive = float4(0, 0, 0, 1);
@@ -34,6 +48,8 @@ float4 main(PSInput input) : SV_TARGET
     float3 V = normalize(ubo.cameraPosition.xyz - input.worldPos);
     float3 H = normalize(L + V);
 
+    float4 diffuse = baseColorTexture.Sample(materialSampler, input.uv) * mesh.baseColorFactor;
+
     float4 finalColor = ambient + emissive;
 
     float NdotL = max(dot(N, L), 0);
@@ -0,0 +1,276 @@
+// Requires TinyGLTF, MappedFile.h, FileService.h & GLTFJsonReader.h
+// Loads binary glTF (.glb) straight out of a memory mapped file.
+// Only the JSON chunk is parsed, the BIN chunk stays inside the mapping
+// and is handed to the renderer as a raw span so it is never copied onto the heap.
+// The .bin files of a .gltf are mapped the same way.
+#ifndef GLB_LOADER_H
+#define GLB_LOADER_H
+
+// Raw bytes backing one glTF buffer, either owned by tinygltf or by a mapping
+struct BufferSpan
+{
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+};
+
+struct GLBChunks
+{
+	const char* json = nullptr;
+	size_t jsonLength = 0;
+	const unsigned char* bin = nullptr;
+	size_t binLength = 0;
+};
+
+// Lower case file extension check, used to pick the GLB or glTF load path
+bool IsGLBFile(const std::string& filePath)
+{
+	if (filePath.size() < 4)
+		return false;
+	std::string extension = filePath.substr(filePath.size() - 4);
+	for (char& c : extension)
+		c = static_cast<char>(tolower(c));
+	return extension == ".glb";
+}
+
+// Points every buffer at the bytes tinygltf loaded for it (.gltf + .bin path)
+void BuildBufferSpans(const tinygltf::Model& model, std::vector<BufferSpan>& spans)
+{
+	spans.resize(model.buffers.size());
+	for (size_t i = 0; i < model.buffers.size(); ++i)
+	{
+		spans[i].data = model.buffers[i].data.data();
+		spans[i].size = model.buffers[i].data.size();
+	}
+}
+
+// Validates the 12 byte GLB header and locates the JSON & BIN chunks in place
+bool ParseGLBChunks(const unsigned char* bytes, size_t size, GLBChunks& chunks, std::string& err)
+{
+	const uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+	const uint32_t CHUNK_JSON = 0x4E4F534A; // "JSON"
+	const uint32_t CHUNK_BIN = 0x004E4942; // "BIN\0"
+
+	if (size < 20)
+	{
+		err = "File is too small to be a GLB container";
+		return false;
+	}
+
+	uint32_t header[3];
+	memcpy(header, bytes, sizeof(header));
+	if (header[0] != GLB_MAGIC || header[1] != 2 || header[2] > size)
+	{
+		err = "Invalid GLB header (expected glTF 2.0 binary)";
+		return false;
+	}
+
+	size_t cursor = 12;
+	size_t end = header[2];
+	while (cursor + 8 <= end)
+	{
+		uint32_t chunkLength, chunkType;
+		memcpy(&chunkLength, bytes + cursor, 4);
+		memcpy(&chunkType, bytes + cursor + 4, 4);
+		cursor += 8;
+		if (cursor + chunkLength > end)
+		{
+			err = "GLB chunk runs past the end of the file";
+			return false;
+		}
+
+		if (chunkType == CHUNK_JSON && chunks.json == nullptr)
+		{
+			chunks.json = reinterpret_cast<const char*>(bytes + cursor);
+			chunks.jsonLength = chunkLength;
+		}
+		else if (chunkType == CHUNK_BIN && chunks.bin == nullptr)
+		{
+			chunks.bin = bytes + cursor;
+			chunks.binLength = chunkLength;
+		}
+		cursor += (chunkLength + 3) & ~size_t(3); // chunks are 4 byte aligned
+	}
+
+	if (chunks.json == nullptr)
+	{
+		err = "GLB container has no JSON chunk";
+		return false;
+	}
+	return true;
+}
+
+// Parses the JSON chunk of a mapped GLB and fills "spans" with pointers into the mapping.
+// The JSON is read in one pass by GLTFJsonReader, buffers and images only ever become metadata:
+// buffer.data stays empty and images stay undecoded.
+bool LoadGLBFromMapping(const MappedFile& file, tinygltf::Model& model, std::vector<BufferSpan>& spans, std::string& err)
+{
+	GLBChunks chunks;
+	if (!ParseGLBChunks(file.Data(), file.Size(), chunks, err))
+		return false;
+
+	std::vector<size_t> bufferLengths;
+	if (!ReadGLTFJson(chunks.json, chunks.jsonLength, model, bufferLengths, err))
+		return false;
+
+	// Only buffers living in the BIN chunk can be zero-copy, let tinygltf handle anything external
+	for (const tinygltf::Buffer& buffer : model.buffers)
+	{
+		if (!buffer.uri.empty())
+		{
+			err = "GLB references an external buffer";
+			return false;
+		}
+	}
+	if (model.buffers.size() > 1)
+	{
+		err = "GLB declares more than one BIN chunk buffer";
+		return false;
+	}
+
+	spans.clear();
+	for (size_t byteLength : bufferLengths)
+	{
+		if (chunks.bin == nullptr || byteLength > chunks.binLength)
+		{
+			err = "GLB buffer is larger than its BIN chunk";
+			return false;
+		}
+		BufferSpan span;
+		span.data = chunks.bin;
+		span.size = byteLength;
+		spans.push_back(span);
+	}
+
+	// tinygltf never saw the BIN chunk, so views can only be checked against the spans here
+	for (const tinygltf::BufferView& view : model.bufferViews)
+	{
+		if (view.buffer < 0 || static_cast<size_t>(view.buffer) >= spans.size() ||
+			view.byteOffset + view.byteLength > spans[view.buffer].size)
+		{
+			err = "GLB bufferView lies outside of the BIN chunk";
+			return false;
+		}
+	}
+	return true;
+}
+
+// Parses a .gltf with GLTFJsonReader and loads its buffers: data URIs are decoded, files next to it are
+// mapped into "files". Images stay undecoded, like they do for GLBs.
+bool LoadGLTFFromFile(const std::string& filePath, tinygltf::Model& model, std::vector<FileView>& files,
+	std::vector<BufferSpan>& spans, std::string& err)
+{
+	std::vector<size_t> bufferLengths;
+	{
+		FileView json = OpenFileView(filePath);
+		if (!json)
+		{
+			err = "Unable to map \"" + filePath + "\"";
+			return false;
+		}
+		if (!ReadGLTFJson(reinterpret_cast<const char*>(json->Data()), json->Size(), model, bufferLengths, err))
+			return false;
+	}
+
+	std::string baseDir = filePath.substr(0, filePath.find_last_of("/\\") + 1);
+	std::vector<size_t> fileBuffers; // mapped buffers, indexed like "mapped"
+	std::vector<FileView> mapped;
+	for (size_t i = 0; i < model.buffers.size(); ++i)
+	{
+		tinygltf::Buffer& buffer = model.buffers[i];
+		std::string mimeType;
+		if (tinygltf::IsDataURI(buffer.uri))
+		{
+			if (!tinygltf::DecodeDataURI(&buffer.data, mimeType, buffer.uri, bufferLengths[i], true))
+			{
+				err = "glTF buffer " + std::to_string(i) + " has a malformed data URI";
+				return false;
+			}
+			continue;
+		}
+
+		std::string fileName;
+		if (buffer.uri.empty() || !tinygltf::URIDecode(buffer.uri, &fileName, nullptr))
+		{
+			err = "glTF buffer " + std::to_string(i) + " has no usable uri";
+			return false;
+		}
+		// mapping is cheap, the pages are faulted in by whatever reads the span
+		FileView file = OpenFileView(baseDir + fileName);
+		if (!file || file->Size() < bufferLengths[i])
+		{
+			err = "Unable to read " + std::to_string(bufferLengths[i]) + " bytes from \"" + baseDir + fileName + "\"";
+			return false;
+		}
+		fileBuffers.push_back(i);
+		mapped.push_back(file);
+	}
+	BuildBufferSpans(model, spans);
+	for (size_t i = 0; i < fileBuffers.size(); ++i)
+	{
+		spans[fileBuffers[i]].data = mapped[i]->Data();
+		spans[fileBuffers[i]].size = bufferLengths[fileBuffers[i]];
+	}
+	files.insert(files.end(), mapped.begin(), mapped.end());
+
+	for (const tinygltf::BufferView& view : model.bufferViews)
+	{
+		if (view.buffer < 0 || static_cast<size_t>(view.buffer) >= spans.size() ||
+			view.byteOffset + view.byteLength > spans[view.buffer].size)
+		{
+			err = "glTF bufferView lies outside of its buffer";
+			return false;
+		}
+	}
+	return true;
+}
+
+// Loads a .gltf or .glb into "model" and fills "spans" with the bytes of every buffer.
+// The mappings the spans point into (the GLB, or the .bin files of a .gltf) are kept in "files".
+// Whatever the single pass reader can't handle falls back to tinygltf's own (DOM based, copying)
+// loaders and leaves "files" empty.
+bool LoadModelFile(tinygltf::TinyGLTF& loader, const std::string& filePath, tinygltf::Model& model,
+	std::vector<FileView>& files, std::vector<BufferSpan>& spans, std::string& err, std::string& warn)
+{
+	files.clear();
+	if (!IsGLBFile(filePath))
+	{
+		if (LoadGLTFFromFile(filePath, model, files, spans, err))
+			return true;
+
+		std::cout << "glTF Warning: single pass load unavailable (" << err << "), using tinygltf instead" << std::endl;
+		err.clear();
+		files.clear();
+		model = tinygltf::Model();
+		// tinygltf doesn't check the indices, a file the single pass reader rejected for one still fails here
+		if (!loader.LoadASCIIFromFile(&model, &err, &warn, filePath) || !ValidateGLTFModel(model, err))
+			return false;
+		BuildBufferSpans(model, spans);
+		return true;
+	}
+
+	FileView mapping = OpenFileView(filePath);
+	if (!mapping)
+	{
+		err = "Unable to map \"" + filePath + "\"";
+		return false;
+	}
+
+	if (LoadGLBFromMapping(*mapping, model, spans, err))
+	{
+		files.push_back(mapping);
+		return true;
+	}
+
+	std::cout << "GLB Warning: zero-copy load unavailable (" << err << "), copying instead" << std::endl;
+	err.clear();
+	model = tinygltf::Model();
+	std::string baseDir = filePath.substr(0, filePath.find_last_of("/\\") + 1);
+	bool ret = loader.LoadBinaryFromMemory(&model, &err, &warn, mapping->Data(),
+		static_cast<unsigned int>(mapping->Size()), baseDir); // tinygltf owns copies of everything once it returns
+	if (!ret || !ValidateGLTFModel(model, err))
+		return false;
+	BuildBufferSpans(model, spans);
+	return true;
+}
+
+#endif
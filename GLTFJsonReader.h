@@ -0,0 +1,572 @@
+// Requires TinyGLTF (and the nlohmann json.hpp it ships with)
+// Fills a tinygltf::Model straight from the JSON token stream (nlohmann's SAX interface) instead of
+// building a DOM first and walking it. Only what the renderer reads is kept: scenes, nodes, meshes,
+// accessors, buffer views, buffers, materials, textures, images and samplers. Extensions, extras,
+// animations, skins & cameras are skipped. Buffers and images are metadata only, the caller
+// resolves their bytes.
+#ifndef GLTF_JSON_READER_H
+#define GLTF_JSON_READER_H
+
+enum GLTF_JSON_SECTION
+{
+	GLTF_JSON_SECTION_NONE = 0, // top level values and anything skipped
+	GLTF_JSON_SECTION_ASSET,
+	GLTF_JSON_SECTION_ACCESSORS,
+	GLTF_JSON_SECTION_BUFFER_VIEWS,
+	GLTF_JSON_SECTION_BUFFERS,
+	GLTF_JSON_SECTION_MESHES,
+	GLTF_JSON_SECTION_NODES,
+	GLTF_JSON_SECTION_SCENES,
+	GLTF_JSON_SECTION_MATERIALS,
+	GLTF_JSON_SECTION_TEXTURES,
+	GLTF_JSON_SECTION_IMAGES,
+	GLTF_JSON_SECTION_SAMPLERS,
+	GLTF_JSON_SECTION_COUNT
+};
+
+const char* const GLTF_JSON_SECTION_NAMES[GLTF_JSON_SECTION_COUNT] = { "", "asset", "accessors", "bufferViews",
+	"buffers", "meshes", "nodes", "scenes", "materials", "textures", "images", "samplers" };
+
+// Every value is identified by its path with array elements written as '#', e.g. "/nodes/#/children/#".
+// Section elements are created when their object opens, the values that follow fill in the newest one.
+class GLTFJsonReader : public nlohmann::json_sax<nlohmann::json>
+{
+	struct Frame
+	{
+		bool array;
+		size_t pathLength; // path before this container's own part
+		size_t index; // elements finished so far (arrays)
+	};
+
+	tinygltf::Model& model;
+	std::vector<size_t>& bufferLengths; // tinygltf::Buffer has no room for byteLength
+	std::string& err;
+	std::vector<Frame> frames;
+	std::string path;
+	std::string lastKey;
+	GLTF_JSON_SECTION section = GLTF_JSON_SECTION_NONE;
+	size_t fieldStart = 0; // where "<field>" starts in "/<section>/#/<field>"
+
+	// path == "/<section>/#/<field>" for the current section
+	bool Field(const char* field) const
+	{
+		size_t length = strlen(field);
+		return path.size() == fieldStart + length && path.compare(fieldStart, length, field) == 0;
+	}
+
+	// path == "/<section>/#/<prefix><lastKey>", for dictionaries like a primitive's attributes
+	bool DictionaryField(const char* prefix) const
+	{
+		size_t length = strlen(prefix);
+		return path.size() == fieldStart + length + lastKey.size() && path.compare(fieldStart, length, prefix) == 0;
+	}
+
+	// scalar arrays replace their default contents with the first element
+	template <typename T>
+	void Append(std::vector<T>& list, T value)
+	{
+		if (frames.back().index == 0)
+			list.clear();
+		list.push_back(value);
+	}
+
+	bool InSection() const { return section != GLTF_JSON_SECTION_NONE && path.size() > fieldStart && fieldStart > 0; }
+
+	void FinishValue()
+	{
+		if (!frames.empty() && frames.back().array)
+			++frames.back().index;
+	}
+
+	static int ParseAccessorType(const std::string& type)
+	{
+		if (type == "SCALAR") return TINYGLTF_TYPE_SCALAR;
+		if (type == "VEC2") return TINYGLTF_TYPE_VEC2;
+		if (type == "VEC3") return TINYGLTF_TYPE_VEC3;
+		if (type == "VEC4") return TINYGLTF_TYPE_VEC4;
+		if (type == "MAT2") return TINYGLTF_TYPE_MAT2;
+		if (type == "MAT3") return TINYGLTF_TYPE_MAT3;
+		if (type == "MAT4") return TINYGLTF_TYPE_MAT4;
+		return -1;
+	}
+
+	void OpenElement()
+	{
+		if (frames.size() == 3 && frames[1].array && section != GLTF_JSON_SECTION_NONE) // "/<section>/#"
+		{
+			switch (section)
+			{
+			case GLTF_JSON_SECTION_ACCESSORS:
+			{
+				tinygltf::Accessor accessor;
+				accessor.sparse.count = 0;
+				accessor.sparse.indices.byteOffset = 0;
+				accessor.sparse.indices.bufferView = -1;
+				accessor.sparse.indices.componentType = -1;
+				accessor.sparse.values.bufferView = -1;
+				accessor.sparse.values.byteOffset = 0;
+				model.accessors.push_back(accessor);
+				break;
+			}
+			case GLTF_JSON_SECTION_BUFFER_VIEWS: model.bufferViews.emplace_back(); break;
+			case GLTF_JSON_SECTION_BUFFERS:
+				model.buffers.emplace_back();
+				bufferLengths.push_back(0);
+				break;
+			case GLTF_JSON_SECTION_MESHES: model.meshes.emplace_back(); break;
+			case GLTF_JSON_SECTION_NODES: model.nodes.emplace_back(); break;
+			case GLTF_JSON_SECTION_SCENES: model.scenes.emplace_back(); break;
+			case GLTF_JSON_SECTION_MATERIALS: model.materials.emplace_back(); break;
+			case GLTF_JSON_SECTION_TEXTURES: model.textures.emplace_back(); break;
+			case GLTF_JSON_SECTION_IMAGES: model.images.emplace_back(); break;
+			case GLTF_JSON_SECTION_SAMPLERS: model.samplers.emplace_back(); break;
+			default: break;
+			}
+			fieldStart = path.size() + 1;
+		}
+		else if (section == GLTF_JSON_SECTION_MESHES && Field("primitives/#") && !model.meshes.empty())
+		{
+			tinygltf::Primitive primitive;
+			primitive.mode = TINYGLTF_MODE_TRIANGLES; // the spec's default, tinygltf fills it in too
+			model.meshes.back().primitives.push_back(primitive);
+		}
+	}
+
+	void Number(double value)
+	{
+		// out of range values turn into indices & sizes the validation rejects
+		int integer = value >= -2147483648.0 && value <= 2147483647.0 ? static_cast<int>(value) : -2;
+		size_t size = value > 0 ? (value < 1.8e19 ? static_cast<size_t>(value) : SIZE_MAX) : 0;
+		if (section == GLTF_JSON_SECTION_NONE)
+		{
+			if (path == "/scene")
+				model.defaultScene = integer;
+			return;
+		}
+		if (!InSection())
+			return;
+
+		switch (section)
+		{
+		case GLTF_JSON_SECTION_ACCESSORS:
+		{
+			tinygltf::Accessor& accessor = model.accessors.back();
+			if (Field("bufferView")) accessor.bufferView = integer;
+			else if (Field("byteOffset")) accessor.byteOffset = size;
+			else if (Field("componentType")) accessor.componentType = integer;
+			else if (Field("count")) accessor.count = size;
+			else if (Field("min/#")) Append(accessor.minValues, value);
+			else if (Field("max/#")) Append(accessor.maxValues, value);
+			else if (Field("sparse/count"))
+			{
+				accessor.sparse.isSparse = true;
+				accessor.sparse.count = integer;
+			}
+			else if (Field("sparse/indices/bufferView")) accessor.sparse.indices.bufferView = integer;
+			else if (Field("sparse/indices/byteOffset")) accessor.sparse.indices.byteOffset = size;
+			else if (Field("sparse/indices/componentType")) accessor.sparse.indices.componentType = integer;
+			else if (Field("sparse/values/bufferView")) accessor.sparse.values.bufferView = integer;
+			else if (Field("sparse/values/byteOffset")) accessor.sparse.values.byteOffset = size;
+			break;
+		}
+		case GLTF_JSON_SECTION_BUFFER_VIEWS:
+		{
+			tinygltf::BufferView& view = model.bufferViews.back();
+			if (Field("buffer")) view.buffer = integer;
+			else if (Field("byteOffset")) view.byteOffset = size;
+			else if (Field("byteLength")) view.byteLength = size;
+			else if (Field("byteStride")) view.byteStride = size;
+			else if (Field("target")) view.target = integer;
+			break;
+		}
+		case GLTF_JSON_SECTION_BUFFERS:
+			if (Field("byteLength")) bufferLengths.back() = size;
+			break;
+		case GLTF_JSON_SECTION_MESHES:
+		{
+			tinygltf::Mesh& mesh = model.meshes.back();
+			if (mesh.primitives.empty())
+				break;
+			tinygltf::Primitive& primitive = mesh.primitives.back();
+			if (DictionaryField("primitives/#/attributes/")) primitive.attributes[lastKey] = integer;
+			else if (Field("primitives/#/indices")) primitive.indices = integer;
+			else if (Field("primitives/#/material")) primitive.material = integer;
+			else if (Field("primitives/#/mode")) primitive.mode = integer;
+			break;
+		}
+		case GLTF_JSON_SECTION_NODES:
+		{
+			tinygltf::Node& node = model.nodes.back();
+			if (Field("mesh")) node.mesh = integer;
+			else if (Field("children/#")) Append(node.children, integer);
+			else if (Field("matrix/#")) Append(node.matrix, value);
+			else if (Field("translation/#")) Append(node.translation, value);
+			else if (Field("rotation/#")) Append(node.rotation, value);
+			else if (Field("scale/#")) Append(node.scale, value);
+			else if (Field("camera")) node.camera = integer;
+			else if (Field("skin")) node.skin = integer;
+			break;
+		}
+		case GLTF_JSON_SECTION_SCENES:
+			if (Field("nodes/#")) Append(model.scenes.back().nodes, integer);
+			break;
+		case GLTF_JSON_SECTION_MATERIALS:
+		{
+			tinygltf::Material& material = model.materials.back();
+			tinygltf::PbrMetallicRoughness& pbr = material.pbrMetallicRoughness;
+			if (Field("pbrMetallicRoughness/baseColorFactor/#")) Append(pbr.baseColorFactor, value);
+			else if (Field("pbrMetallicRoughness/metallicFactor")) pbr.metallicFactor = value;
+			else if (Field("pbrMetallicRoughness/roughnessFactor")) pbr.roughnessFactor = value;
+			else if (Field("pbrMetallicRoughness/baseColorTexture/index")) pbr.baseColorTexture.index = integer;
+			else if (Field("pbrMetallicRoughness/baseColorTexture/texCoord")) pbr.baseColorTexture.texCoord = integer;
+			else if (Field("pbrMetallicRoughness/metallicRoughnessTexture/index")) pbr.metallicRoughnessTexture.index = integer;
+			else if (Field("pbrMetallicRoughness/metallicRoughnessTexture/texCoord")) pbr.metallicRoughnessTexture.texCoord = integer;
+			else if (Field("normalTexture/index")) material.normalTexture.index = integer;
+			else if (Field("normalTexture/texCoord")) material.normalTexture.texCoord = integer;
+			else if (Field("normalTexture/scale")) material.normalTexture.scale = value;
+			else if (Field("occlusionTexture/index")) material.occlusionTexture.index = integer;
+			else if (Field("occlusionTexture/texCoord")) material.occlusionTexture.texCoord = integer;
+			else if (Field("occlusionTexture/strength")) material.occlusionTexture.strength = value;
+			else if (Field("emissiveTexture/index")) material.emissiveTexture.index = integer;
+			else if (Field("emissiveTexture/texCoord")) material.emissiveTexture.texCoord = integer;
+			else if (Field("emissiveFactor/#")) Append(material.emissiveFactor, value);
+			else if (Field("alphaCutoff")) material.alphaCutoff = value;
+			break;
+		}
+		case GLTF_JSON_SECTION_TEXTURES:
+			if (Field("sampler")) model.textures.back().sampler = integer;
+			else if (Field("source")) model.textures.back().source = integer;
+			break;
+		case GLTF_JSON_SECTION_IMAGES:
+			if (Field("bufferView")) model.images.back().bufferView = integer;
+			break;
+		case GLTF_JSON_SECTION_SAMPLERS:
+		{
+			tinygltf::Sampler& sampler = model.samplers.back();
+			if (Field("magFilter")) sampler.magFilter = integer;
+			else if (Field("minFilter")) sampler.minFilter = integer;
+			else if (Field("wrapS")) sampler.wrapS = integer;
+			else if (Field("wrapT")) sampler.wrapT = integer;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	void Text(const std::string& value)
+	{
+		if (section == GLTF_JSON_SECTION_NONE)
+		{
+			if (path == "/extensionsUsed/#")
+				model.extensionsUsed.push_back(value);
+			else if (path == "/extensionsRequired/#")
+				model.extensionsRequired.push_back(value);
+			return;
+		}
+		if (section == GLTF_JSON_SECTION_ASSET)
+		{
+			if (path == "/asset/version") model.asset.version = value;
+			else if (path == "/asset/generator") model.asset.generator = value;
+			else if (path == "/asset/minVersion") model.asset.minVersion = value;
+			else if (path == "/asset/copyright") model.asset.copyright = value;
+			return;
+		}
+		if (!InSection())
+			return;
+
+		bool name = Field("name");
+		switch (section)
+		{
+		case GLTF_JSON_SECTION_ACCESSORS:
+			if (Field("type")) model.accessors.back().type = ParseAccessorType(value);
+			else if (name) model.accessors.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_BUFFER_VIEWS:
+			if (name) model.bufferViews.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_BUFFERS:
+			if (Field("uri")) model.buffers.back().uri = value;
+			else if (name) model.buffers.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_MESHES:
+			if (name) model.meshes.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_NODES:
+			if (name) model.nodes.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_SCENES:
+			if (name) model.scenes.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_MATERIALS:
+			if (Field("alphaMode")) model.materials.back().alphaMode = value;
+			else if (name) model.materials.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_TEXTURES:
+			if (name) model.textures.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_IMAGES:
+			if (Field("uri")) model.images.back().uri = value;
+			else if (Field("mimeType")) model.images.back().mimeType = value;
+			else if (name) model.images.back().name = value;
+			break;
+		case GLTF_JSON_SECTION_SAMPLERS:
+			if (name) model.samplers.back().name = value;
+			break;
+		default:
+			break;
+		}
+	}
+
+	void Boolean(bool value)
+	{
+		if (!InSection())
+			return;
+		if (section == GLTF_JSON_SECTION_ACCESSORS && Field("normalized"))
+			model.accessors.back().normalized = value;
+		else if (section == GLTF_JSON_SECTION_MATERIALS && Field("doubleSided"))
+			model.materials.back().doubleSided = value;
+	}
+
+public:
+	GLTFJsonReader(tinygltf::Model& _model, std::vector<size_t>& _bufferLengths, std::string& _err) :
+		model(_model), bufferLengths(_bufferLengths), err(_err)
+	{
+		path.reserve(256);
+	}
+
+	bool null() override
+	{
+		FinishValue();
+		return true;
+	}
+
+	bool boolean(bool value) override
+	{
+		Boolean(value);
+		FinishValue();
+		return true;
+	}
+
+	bool number_integer(number_integer_t value) override
+	{
+		Number(static_cast<double>(value));
+		FinishValue();
+		return true;
+	}
+
+	bool number_unsigned(number_unsigned_t value) override
+	{
+		Number(static_cast<double>(value));
+		FinishValue();
+		return true;
+	}
+
+	bool number_float(number_float_t value, const string_t&) override
+	{
+		Number(value);
+		FinishValue();
+		return true;
+	}
+
+	bool string(string_t& value) override
+	{
+		Text(value);
+		FinishValue();
+		return true;
+	}
+
+	bool binary(binary_t&) override
+	{
+		FinishValue();
+		return true;
+	}
+
+	bool start_object(std::size_t) override
+	{
+		Frame frame = { false, path.size(), 0 };
+		frames.push_back(frame);
+		OpenElement();
+		return true;
+	}
+
+	bool key(string_t& value) override
+	{
+		path.resize(frames.back().pathLength);
+		path += '/';
+		path += value;
+		lastKey = value;
+		if (frames.size() == 1) // a new top level member picks the section
+		{
+			section = GLTF_JSON_SECTION_NONE;
+			for (int i = 1; i < GLTF_JSON_SECTION_COUNT; ++i)
+			{
+				if (value == GLTF_JSON_SECTION_NAMES[i])
+					section = static_cast<GLTF_JSON_SECTION>(i);
+			}
+			fieldStart = 0;
+		}
+		return true;
+	}
+
+	bool end_object() override
+	{
+		path.resize(frames.back().pathLength);
+		frames.pop_back();
+		FinishValue();
+		return true;
+	}
+
+	bool start_array(std::size_t) override
+	{
+		Frame frame = { true, path.size(), 0 };
+		frames.push_back(frame);
+		path += "/#";
+		return true;
+	}
+
+	bool end_array() override
+	{
+		path.resize(frames.back().pathLength);
+		frames.pop_back();
+		FinishValue();
+		return true;
+	}
+
+	bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& exception) override
+	{
+		err = std::string("glTF JSON could not be parsed: ") + exception.what();
+		return false;
+	}
+};
+
+// Every index a glTF object holds must name an existing object, tinygltf checked this before
+bool ValidateGLTFModel(const tinygltf::Model& model, std::string& err)
+{
+	auto valid = [](int index, size_t count, bool optional)
+	{
+		return (optional && index == -1) || (index >= 0 && static_cast<size_t>(index) < count);
+	};
+	for (const tinygltf::Accessor& accessor : model.accessors)
+	{
+		if (!valid(accessor.bufferView, model.bufferViews.size(), true) || accessor.type < 0 ||
+			tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType)) <= 0 ||
+			(accessor.sparse.isSparse && (!valid(accessor.sparse.indices.bufferView, model.bufferViews.size(), false) ||
+				!valid(accessor.sparse.values.bufferView, model.bufferViews.size(), false))))
+		{
+			err = "glTF accessor \"" + accessor.name + "\" is incomplete or references a missing bufferView";
+			return false;
+		}
+	}
+	for (const tinygltf::BufferView& view : model.bufferViews)
+	{
+		if (!valid(view.buffer, model.buffers.size(), false))
+		{
+			err = "glTF bufferView \"" + view.name + "\" references a missing buffer";
+			return false;
+		}
+	}
+	for (const tinygltf::Mesh& mesh : model.meshes)
+	{
+		for (const tinygltf::Primitive& primitive : mesh.primitives)
+		{
+			bool attributes = true;
+			for (const auto& attribute : primitive.attributes)
+				attributes = attributes && valid(attribute.second, model.accessors.size(), false);
+			if (!attributes || !valid(primitive.indices, model.accessors.size(), true) ||
+				!valid(primitive.material, model.materials.size(), true))
+			{
+				err = "glTF mesh \"" + mesh.name + "\" references a missing accessor or material";
+				return false;
+			}
+		}
+	}
+	for (const tinygltf::Node& node : model.nodes)
+	{
+		bool children = true;
+		for (int child : node.children)
+			children = children && valid(child, model.nodes.size(), false);
+		if (!valid(node.mesh, model.meshes.size(), true) || !children)
+		{
+			err = "glTF node \"" + node.name + "\" references a missing mesh or child node";
+			return false;
+		}
+	}
+	for (const tinygltf::Scene& scene : model.scenes)
+	{
+		for (int node : scene.nodes)
+		{
+			if (!valid(node, model.nodes.size(), false))
+			{
+				err = "glTF scene \"" + scene.name + "\" references a missing node";
+				return false;
+			}
+		}
+	}
+	for (const tinygltf::Texture& texture : model.textures)
+	{
+		if (!valid(texture.source, model.images.size(), true) || !valid(texture.sampler, model.samplers.size(), true))
+		{
+			err = "glTF texture \"" + texture.name + "\" references a missing image or sampler";
+			return false;
+		}
+	}
+	for (const tinygltf::Material& material : model.materials)
+	{
+		if (material.pbrMetallicRoughness.baseColorFactor.size() != 4 || material.emissiveFactor.size() != 3 ||
+			!valid(material.pbrMetallicRoughness.baseColorTexture.index, model.textures.size(), true) ||
+			!valid(material.pbrMetallicRoughness.metallicRoughnessTexture.index, model.textures.size(), true) ||
+			!valid(material.normalTexture.index, model.textures.size(), true) ||
+			!valid(material.occlusionTexture.index, model.textures.size(), true) ||
+			!valid(material.emissiveTexture.index, model.textures.size(), true))
+		{
+			err = "glTF material \"" + material.name + "\" has malformed factors or references a missing texture";
+			return false;
+		}
+	}
+	if (model.defaultScene >= 0 && static_cast<size_t>(model.defaultScene) >= model.scenes.size())
+	{
+		err = "glTF default scene does not exist";
+		return false;
+	}
+	return true;
+}
+
+// Views used by primitives get the target tinygltf would have inferred for them
+void AssignBufferViewTargets(tinygltf::Model& model)
+{
+	for (const tinygltf::Mesh& mesh : model.meshes)
+	{
+		for (const tinygltf::Primitive& primitive : mesh.primitives)
+		{
+			if (primitive.indices >= 0 && model.accessors[primitive.indices].bufferView >= 0)
+				model.bufferViews[model.accessors[primitive.indices].bufferView].target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
+			for (const auto& attribute : primitive.attributes)
+			{
+				if (model.accessors[attribute.second].bufferView >= 0)
+					model.bufferViews[model.accessors[attribute.second].bufferView].target = TINYGLTF_TARGET_ARRAY_BUFFER;
+			}
+		}
+	}
+}
+
+// Parses "length" bytes of glTF JSON into "model" in a single pass, "bufferLengths" gets every buffer's byteLength
+bool ReadGLTFJson(const char* json, size_t length, tinygltf::Model& model, std::vector<size_t>& bufferLengths,
+	std::string& err)
+{
+	model = tinygltf::Model();
+	bufferLengths.clear();
+	GLTFJsonReader reader(model, bufferLengths, err);
+	if (!nlohmann::json::sax_parse(json, json + length, &reader))
+	{
+		if (err.empty())
+			err = "glTF JSON could not be parsed";
+		return false;
+	}
+	if (!ValidateGLTFModel(model, err))
+		return false;
+	AssignBufferViewTargets(model);
+	return true;
+}
+
+#endif
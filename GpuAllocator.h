@@ -0,0 +1,393 @@
+// Requires Vulkan
+// Renderer owned GPU memory allocator. Memory is taken from the driver in large blocks
+// (one list per memory type) and handed out with a buddy allocator, so creating a buffer or
+// image costs no vkAllocateMemory and the driver's maxMemoryAllocationCount is never approached.
+// Host visible blocks are mapped once for their whole lifetime. Empty blocks go back to the driver,
+// except for one spare shared block per memory type.
+#ifndef GPU_ALLOCATOR_H
+#define GPU_ALLOCATOR_H
+
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+const VkDeviceSize GPU_ALLOCATOR_BLOCK_SIZE = 64ull << 20; // capped to 1/8th of small heaps
+const VkDeviceSize GPU_ALLOCATOR_MIN_SIZE = 256; // smallest buddy, also the minimum alignment
+
+struct GpuAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0; // size that was requested, the buddy backing it may be larger
+	unsigned char* mapped = nullptr; // start of this allocation when the memory is host visible
+	uint32_t memoryType = 0;
+	uint32_t block = 0;
+};
+
+struct GpuAllocatorStats
+{
+	uint64_t blockCount = 0;
+	uint64_t blockBytes = 0; // reserved from the driver
+	uint64_t allocationCount = 0;
+	uint64_t requestedBytes = 0; // asked for by callers
+	uint64_t usedBytes = 0; // buddies handed out, includes rounding waste
+	uint64_t peakUsedBytes = 0;
+};
+
+class GpuAllocator
+{
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		unsigned char* mapped = nullptr;
+		bool linear = true; // buffers and linear images never share a block with optimal images
+		bool dedicated = false; // holds exactly one allocation that was too big for a block
+		std::vector<std::set<VkDeviceSize>> freeLists; // free offsets per order, order 0 = GPU_ALLOCATOR_MIN_SIZE
+		std::unordered_map<VkDeviceSize, uint32_t> allocated; // offset -> order
+	};
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	VkDeviceSize blockSizes[VK_MAX_MEMORY_TYPES] = {};
+	std::vector<Block> blocks[VK_MAX_MEMORY_TYPES];
+	GpuAllocatorStats stats;
+	std::mutex lock;
+
+	static uint32_t OrderOf(VkDeviceSize size)
+	{
+		uint32_t order = 0;
+		while ((GPU_ALLOCATOR_MIN_SIZE << order) < size)
+			++order;
+		return order;
+	}
+
+	bool FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t& outType) const
+	{
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+		{
+			if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			{
+				outType = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Reuses the slot of a released block when there is one, so GpuAllocation::block indices stay stable
+	bool AllocateBlock(uint32_t memoryType, VkDeviceSize size, bool linear, bool dedicated, uint32_t& outIndex)
+	{
+		VkMemoryAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocateInfo.allocationSize = size;
+		allocateInfo.memoryTypeIndex = memoryType;
+
+		Block block;
+		if (vkAllocateMemory(device, &allocateInfo, nullptr, &block.memory) != VK_SUCCESS)
+			return false;
+		block.size = size;
+		block.linear = linear;
+		block.dedicated = dedicated;
+		if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			void* mapped = nullptr;
+			if (vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+			{
+				vkFreeMemory(device, block.memory, nullptr);
+				return false;
+			}
+			block.mapped = static_cast<unsigned char*>(mapped);
+		}
+		if (!dedicated)
+		{
+			block.freeLists.resize(OrderOf(size) + 1);
+			block.freeLists.back().insert(0);
+		}
+
+		std::vector<Block>& typeBlocks = blocks[memoryType];
+		for (outIndex = 0; outIndex < typeBlocks.size() && typeBlocks[outIndex].memory != VK_NULL_HANDLE; ++outIndex)
+			;
+		if (outIndex < typeBlocks.size())
+			typeBlocks[outIndex] = std::move(block);
+		else
+			typeBlocks.push_back(std::move(block));
+		++stats.blockCount;
+		stats.blockBytes += size;
+		return true;
+	}
+
+	// Gives the memory of an empty block back to the driver, its slot stays for AllocateBlock to reuse
+	void ReleaseBlock(Block& block)
+	{
+		if (block.mapped)
+			vkUnmapMemory(device, block.memory);
+		vkFreeMemory(device, block.memory, nullptr);
+		--stats.blockCount;
+		stats.blockBytes -= block.size;
+		block = Block();
+	}
+
+	// Splits the smallest free buddy that fits down to "order", returns false if the block is too full
+	static bool TakeBuddy(Block& block, uint32_t order, VkDeviceSize& outOffset)
+	{
+		uint32_t source = order;
+		while (source < block.freeLists.size() && block.freeLists[source].empty())
+			++source;
+		if (source >= block.freeLists.size())
+			return false;
+
+		VkDeviceSize offset = *block.freeLists[source].begin();
+		block.freeLists[source].erase(block.freeLists[source].begin());
+		while (source > order) // hand the upper halves back as free buddies
+		{
+			--source;
+			block.freeLists[source].insert(offset + (GPU_ALLOCATOR_MIN_SIZE << source));
+		}
+		block.allocated[offset] = order;
+		outOffset = offset;
+		return true;
+	}
+
+public:
+	GpuAllocator() = default;
+	GpuAllocator(const GpuAllocator&) = delete;
+	GpuAllocator& operator=(const GpuAllocator&) = delete;
+
+	void Create(VkPhysicalDevice _physicalDevice, VkDevice _device, VkDeviceSize blockSize = GPU_ALLOCATOR_BLOCK_SIZE)
+	{
+		physicalDevice = _physicalDevice;
+		device = _device;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+		{
+			// blocks stay powers of two so every buddy is naturally aligned to its own size
+			VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size;
+			VkDeviceSize size = GPU_ALLOCATOR_MIN_SIZE << OrderOf(blockSize);
+			while (size > GPU_ALLOCATOR_MIN_SIZE && size > heapSize / 8)
+				size >>= 1;
+			blockSizes[i] = size;
+		}
+	}
+
+	// Sub-allocates memory satisfying "requirements" (size, alignment and allowed types)
+	bool Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear,
+		GpuAllocation& outAllocation)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		uint32_t memoryType;
+		if (!FindMemoryType(requirements.memoryTypeBits, properties, memoryType))
+			return false;
+
+		// a buddy's offset is a multiple of its size, so rounding up to the alignment aligns it too
+		VkDeviceSize needed = std::max(requirements.size, std::max(requirements.alignment, GPU_ALLOCATOR_MIN_SIZE));
+		uint32_t order = OrderOf(needed);
+		std::vector<Block>& typeBlocks = blocks[memoryType];
+
+		uint32_t blockIndex = 0;
+		VkDeviceSize offset = 0;
+		bool found = false;
+		if ((GPU_ALLOCATOR_MIN_SIZE << order) > blockSizes[memoryType])
+		{
+			// too big to share, give it a block of its own
+			if (!AllocateBlock(memoryType, requirements.size, linear, true, blockIndex))
+				return false;
+			typeBlocks[blockIndex].allocated[0] = order;
+			found = true;
+		}
+		else
+		{
+			for (blockIndex = 0; blockIndex < typeBlocks.size() && !found; ++blockIndex)
+			{
+				Block& block = typeBlocks[blockIndex];
+				found = !block.dedicated && block.memory != VK_NULL_HANDLE && block.linear == linear &&
+					TakeBuddy(block, order, offset);
+			}
+			if (found)
+				--blockIndex;
+			else if (AllocateBlock(memoryType, blockSizes[memoryType], linear, false, blockIndex))
+				found = TakeBuddy(typeBlocks[blockIndex], order, offset);
+			if (!found)
+				return false;
+		}
+
+		Block& block = typeBlocks[blockIndex];
+		outAllocation.memory = block.memory;
+		outAllocation.offset = offset;
+		outAllocation.size = requirements.size;
+		outAllocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+		outAllocation.memoryType = memoryType;
+		outAllocation.block = blockIndex;
+
+		++stats.allocationCount;
+		stats.requestedBytes += requirements.size;
+		stats.usedBytes += block.dedicated ? block.size : (GPU_ALLOCATOR_MIN_SIZE << order);
+		stats.peakUsedBytes = std::max(stats.peakUsedBytes, stats.usedBytes);
+		return true;
+	}
+
+	// Bytes an allocation of "requirements" would take out of the heap: its buddy, or the dedicated block
+	// it gets when it is too big to share one. 0 when no memory type fits.
+	VkDeviceSize GetAllocationSize(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties) const
+	{
+		uint32_t memoryType;
+		if (!FindMemoryType(requirements.memoryTypeBits, properties, memoryType))
+			return 0;
+		VkDeviceSize needed = std::max(requirements.size, std::max(requirements.alignment, GPU_ALLOCATOR_MIN_SIZE));
+		VkDeviceSize buddy = GPU_ALLOCATOR_MIN_SIZE << OrderOf(needed);
+		return buddy > blockSizes[memoryType] ? requirements.size : buddy;
+	}
+
+	// Bytes "allocation" takes out of the heap, what GetAllocationSize predicted for it
+	VkDeviceSize GetAllocatedSize(const GpuAllocation& allocation)
+	{
+		if (allocation.memory == VK_NULL_HANDLE)
+			return 0;
+		std::lock_guard<std::mutex> guard(lock);
+		const Block& block = blocks[allocation.memoryType][allocation.block];
+		auto found = block.allocated.find(allocation.offset);
+		if (found == block.allocated.end())
+			return 0;
+		return block.dedicated ? block.size : (GPU_ALLOCATOR_MIN_SIZE << found->second);
+	}
+
+	// Returns the buddy and merges it with its free neighbours. A dedicated block goes back to the driver
+	// right away, an empty shared one once another empty shared block of its memory type is kept as a spare.
+	void Free(GpuAllocation& allocation)
+	{
+		if (allocation.memory == VK_NULL_HANDLE)
+			return;
+		std::lock_guard<std::mutex> guard(lock);
+		std::vector<Block>& typeBlocks = blocks[allocation.memoryType];
+		Block& block = typeBlocks[allocation.block];
+		auto found = block.allocated.find(allocation.offset);
+		if (found == block.allocated.end())
+			return;
+		uint32_t order = found->second;
+		VkDeviceSize offset = allocation.offset;
+		block.allocated.erase(found);
+
+		--stats.allocationCount;
+		stats.requestedBytes -= allocation.size;
+		stats.usedBytes -= block.dedicated ? block.size : (GPU_ALLOCATOR_MIN_SIZE << order);
+		uint32_t blockIndex = allocation.block;
+		allocation = GpuAllocation();
+		if (block.dedicated)
+		{
+			ReleaseBlock(block);
+			return;
+		}
+
+		while (order + 1 < block.freeLists.size())
+		{
+			VkDeviceSize buddy = offset ^ (GPU_ALLOCATOR_MIN_SIZE << order);
+			auto free = block.freeLists[order].find(buddy);
+			if (free == block.freeLists[order].end())
+				break;
+			block.freeLists[order].erase(free);
+			offset = std::min(offset, buddy);
+			++order;
+		}
+		block.freeLists[order].insert(offset);
+		if (!block.allocated.empty())
+			return;
+
+		for (uint32_t i = 0; i < typeBlocks.size(); ++i)
+		{
+			const Block& spare = typeBlocks[i];
+			if (i != blockIndex && !spare.dedicated && spare.memory != VK_NULL_HANDLE && spare.allocated.empty())
+			{
+				ReleaseBlock(block);
+				return;
+			}
+		}
+	}
+
+	VkResult CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		VkBuffer* outBuffer, GpuAllocation* outAllocation)
+	{
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = usage;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VkResult r = vkCreateBuffer(device, &bufferInfo, nullptr, outBuffer);
+		if (r != VK_SUCCESS)
+			return r;
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, *outBuffer, &requirements);
+		if (!Allocate(requirements, properties, true, *outAllocation))
+		{
+			vkDestroyBuffer(device, *outBuffer, nullptr);
+			*outBuffer = VK_NULL_HANDLE;
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+		return vkBindBufferMemory(device, *outBuffer, outAllocation->memory, outAllocation->offset);
+	}
+
+	VkResult CreateImage(const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties,
+		VkImage* outImage, GpuAllocation* outAllocation)
+	{
+		VkResult r = vkCreateImage(device, &imageInfo, nullptr, outImage);
+		if (r != VK_SUCCESS)
+			return r;
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, *outImage, &requirements);
+		if (!Allocate(requirements, properties, imageInfo.tiling == VK_IMAGE_TILING_LINEAR, *outAllocation))
+		{
+			vkDestroyImage(device, *outImage, nullptr);
+			*outImage = VK_NULL_HANDLE;
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+		return vkBindImageMemory(device, *outImage, outAllocation->memory, outAllocation->offset);
+	}
+
+	void DestroyBuffer(VkBuffer& buffer, GpuAllocation& allocation)
+	{
+		vkDestroyBuffer(device, buffer, nullptr);
+		buffer = VK_NULL_HANDLE;
+		Free(allocation);
+	}
+
+	void DestroyImage(VkImage& image, GpuAllocation& allocation)
+	{
+		vkDestroyImage(device, image, nullptr);
+		image = VK_NULL_HANDLE;
+		Free(allocation);
+	}
+
+	GpuAllocatorStats GetStats()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return stats;
+	}
+
+	void PrintStats()
+	{
+		GpuAllocatorStats current = GetStats();
+		std::cout << "GPU memory: " << current.blockCount << " blocks (" << (current.blockBytes >> 10) << " KB), "
+			<< current.allocationCount << " allocations, " << (current.requestedBytes >> 10) << " KB requested, "
+			<< (current.usedBytes >> 10) << " KB used, " << (current.peakUsedBytes >> 10) << " KB peak" << std::endl;
+	}
+
+	// Releases every block, all allocations must be dead by now
+	void Destroy()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (std::vector<Block>& typeBlocks : blocks)
+		{
+			for (Block& block : typeBlocks)
+			{
+				if (block.memory != VK_NULL_HANDLE)
+					ReleaseBlock(block);
+			}
+			typeBlocks.clear();
+		}
+		stats = GpuAllocatorStats();
+	}
+};
+
+#endif
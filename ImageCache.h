@@ -0,0 +1,261 @@
+// Requires ContentHash.h, MappedFile.h, FileService.h, CacheFolder.h & TextureLoader.h
+// On-disk cache of decoded images: the RGBA8 mip chain DecodeModelImage builds, keyed by a hash of the
+// encoded bytes and of what decoding depends on. A hit is mapped, not read, and the renderer uploads
+// straight out of the mapping, so a warm start costs about what paging the file in does. An index in
+// the folder tracks when each entry was last used, the oldest are deleted once the folder outgrows its limit.
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <algorithm>
+#include <fstream>
+
+const char IMAGE_CACHE_MAGIC[4] = { 'I', 'M', 'G', 'C' };
+const uint32_t IMAGE_CACHE_VERSION = 1; // bump when decoding or the mip filter changes
+const uint64_t IMAGE_CACHE_ALIGNMENT = 16; // the levels start on a texel copy boundary
+const uint64_t IMAGE_CACHE_LIMIT = uint64_t(1) << 30; // bytes of entries kept before the least recently used go
+const char IMAGE_CACHE_INDEX_MAGIC[4] = { 'I', 'M', 'G', 'I' };
+
+struct ImageCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key; // repeated so a renamed file can't be mistaken for another image
+	uint32_t width;
+	uint32_t height;
+	uint32_t format; // TEXTURE_FORMAT
+	uint32_t levelCount; // followed by that many 64-bit level offsets, then the levels
+	uint64_t levelsOffset;
+	uint64_t levelsSize;
+};
+
+// The index file: a header followed by "entryCount" entries
+struct ImageCacheIndexHeader
+{
+	char magic[4];
+	uint32_t entryCount;
+	uint64_t generation; // bumped by every load that touches the cache
+};
+
+struct ImageCacheIndexEntry
+{
+	uint64_t key;
+	uint64_t size; // of the whole file
+	uint64_t lastUse; // generation of the last load that used it
+};
+
+// Sizes are fixed by the image cache file format
+static_assert(sizeof(ImageCacheHeader) == 48, "ImageCacheHeader size");
+static_assert(sizeof(ImageCacheIndexHeader) == 16, "ImageCacheIndexHeader size");
+static_assert(sizeof(ImageCacheIndexEntry) == 24, "ImageCacheIndexEntry size");
+
+// sRGB images are filtered in linear light, so the same bytes decode to other mips as linear data
+uint64_t GetImageCacheKey(const unsigned char* encoded, size_t size, bool srgb)
+{
+	uint64_t hash = HashBytes(encoded, size);
+	hash = HashBytes(&srgb, sizeof(srgb), hash);
+	return HashBytes(&IMAGE_CACHE_VERSION, sizeof(IMAGE_CACHE_VERSION), hash);
+}
+
+std::string GetImageCachePath(const std::string& cacheFolder, uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.image", static_cast<unsigned long long>(key));
+	return cacheFolder + name;
+}
+
+uint64_t GetImageCacheLevelsOffset(size_t levelCount)
+{
+	uint64_t offsetsEnd = sizeof(ImageCacheHeader) + uint64_t(levelCount) * sizeof(uint64_t);
+	return (offsetsEnd + IMAGE_CACHE_ALIGNMENT - 1) & ~(IMAGE_CACHE_ALIGNMENT - 1);
+}
+
+// Points "image" at the levels of a valid entry, false on a miss or a damaged file. Unlike the shader
+// cache the levels aren't hashed again, that would cost as much as reading them; a file of the wrong
+// size or format (RGBA8, sRGB when "image" is) is still caught.
+bool ReadImageCache(const std::string& cachePath, uint64_t key, DecodedImage& image)
+{
+	FileView file = OpenFileView(cachePath);
+	if (!file || file->Size() < sizeof(ImageCacheHeader))
+		return false;
+
+	ImageCacheHeader header;
+	memcpy(&header, file->Data(), sizeof(header));
+	uint64_t offsetsEnd = sizeof(header) + uint64_t(header.levelCount) * sizeof(uint64_t);
+	if (memcmp(header.magic, IMAGE_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != IMAGE_CACHE_VERSION ||
+		header.key != key || header.format != (image.srgb ? TEXTURE_FORMAT_RGBA8_SRGB : TEXTURE_FORMAT_RGBA8) ||
+		header.width == 0 || header.height == 0 || header.levelCount == 0 ||
+		header.levelCount > GetMipLevelCount(header.width, header.height) || header.levelsOffset < offsetsEnd ||
+		header.levelsOffset > file->Size() || header.levelsSize != file->Size() - header.levelsOffset)
+	{
+		return false;
+	}
+
+	std::vector<uint64_t> offsets(header.levelCount);
+	memcpy(offsets.data(), file->Data() + sizeof(header), offsets.size() * sizeof(uint64_t));
+	for (uint32_t level = 0; level < header.levelCount; ++level)
+	{
+		uint64_t end = level + 1 < header.levelCount ? offsets[level + 1] : header.levelsSize;
+		if (offsets[level] > end || end - offsets[level] != GetTextureLevelSize(header.format,
+			std::max(header.width >> level, 1u), std::max(header.height >> level, 1u)))
+		{
+			return false;
+		}
+	}
+
+	image.width = header.width;
+	image.height = header.height;
+	image.format = header.format;
+	image.levelOffsets.assign(offsets.begin(), offsets.end());
+	std::vector<unsigned char>().swap(image.pixels);
+	image.mappedLevels = file->Data() + header.levelsOffset;
+	image.mappedSize = static_cast<size_t>(header.levelsSize);
+	image.mapping = file;
+	return true;
+}
+
+bool WriteImageCache(const std::string& cachePath, uint64_t key, const DecodedImage& image)
+{
+	ImageCacheHeader header = {};
+	memcpy(header.magic, IMAGE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = IMAGE_CACHE_VERSION;
+	header.key = key;
+	header.width = image.width;
+	header.height = image.height;
+	header.format = image.format;
+	header.levelCount = static_cast<uint32_t>(image.levelOffsets.size());
+	uint64_t offsetsEnd = sizeof(header) + uint64_t(header.levelCount) * sizeof(uint64_t);
+	header.levelsOffset = GetImageCacheLevelsOffset(image.levelOffsets.size());
+	header.levelsSize = image.GetLevelsSize();
+	std::vector<uint64_t> offsets(image.levelOffsets.begin(), image.levelOffsets.end());
+
+	// written under a temporary name so a concurrent launch never maps half a file
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+		const char padding[IMAGE_CACHE_ALIGNMENT] = {};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+		file.write(padding, static_cast<std::streamsize>(header.levelsOffset - offsetsEnd));
+		file.write(reinterpret_cast<const char*>(image.GetLevels()), static_cast<std::streamsize>(image.GetLevelsSize()));
+		if (!file)
+			return false;
+	}
+	std::remove(cachePath.c_str());
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+// Reads the images in "used" that are cached in "cacheFolder" and lists the rest in "remaining", with the
+// key each one goes into the cache under once it is decoded in "keys" (indexed like the model's images)
+void ReadImageCaches(const std::string& cacheFolder, const std::vector<EncodedImage>& encoded, const std::vector<int>& used,
+	std::vector<DecodedImage>& images, std::vector<int>& remaining, std::vector<uint64_t>& keys)
+{
+	remaining.clear();
+	keys.assign(encoded.size(), 0);
+	for (int image : used)
+	{
+		if (!encoded[image].data)
+		{
+			remaining.push_back(image); // decoding reports it
+			continue;
+		}
+		keys[image] = GetImageCacheKey(encoded[image].data, encoded[image].size, images[image].srgb);
+		if (!ReadImageCache(GetImageCachePath(cacheFolder, keys[image]), keys[image], images[image]))
+			remaining.push_back(image);
+	}
+}
+
+// Caches the freshly decoded images in "decoded", a failed write only costs the next launch a decode
+void WriteImageCaches(const std::string& cacheFolder, const std::vector<int>& decoded,
+	const std::vector<DecodedImage>& images, const std::vector<uint64_t>& keys)
+{
+	for (int image : decoded)
+	{
+		std::string cachePath = GetImageCachePath(cacheFolder, keys[image]);
+		if (!WriteImageCache(cachePath, keys[image], images[image]))
+			std::cout << "Image cache \"" << cachePath << "\" could not be written" << std::endl;
+	}
+}
+
+// Swaps the decoded levels of "decoded" on the heap for mappings of the entries WriteImageCaches just wrote,
+// so what the renderer keeps for residency is page cache rather than process memory
+void RemapImageCaches(const std::string& cacheFolder, const std::vector<int>& decoded, std::vector<DecodedImage>& images,
+	const std::vector<uint64_t>& keys)
+{
+	for (int image : decoded)
+	{
+		if (keys[image])
+			ReadImageCache(GetImageCachePath(cacheFolder, keys[image]), keys[image], images[image]);
+	}
+}
+
+// Marks the entries of "used" (keys from ReadImageCaches) as used by this load, then deletes the least
+// recently used entries until the folder holds at most "limit" bytes. The entries of this load are never
+// deleted, and one that can't be (still mapped by another process) stays in the index for the next trim.
+void TrimImageCache(const std::string& cacheFolder, const std::vector<int>& used, const std::vector<DecodedImage>& images,
+	const std::vector<uint64_t>& keys, uint64_t limit = IMAGE_CACHE_LIMIT)
+{
+	std::string indexPath = cacheFolder + "index";
+	ImageCacheIndexHeader header = {};
+	std::vector<ImageCacheIndexEntry> entries;
+	{
+		std::ifstream file(indexPath, std::ios::binary);
+		if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+			memcmp(header.magic, IMAGE_CACHE_INDEX_MAGIC, sizeof(header.magic)) == 0 && header.entryCount <= (1u << 20))
+		{
+			entries.resize(header.entryCount);
+			if (!file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(ImageCacheIndexEntry)))
+				entries.clear(); // a damaged index forgets its entries, they are re-added as they get used
+		}
+		else
+			header.generation = 0;
+	}
+
+	uint64_t generation = ++header.generation;
+	for (int image : used)
+	{
+		if (!keys[image])
+			continue;
+		uint64_t size = GetImageCacheLevelsOffset(images[image].levelOffsets.size()) + images[image].GetLevelsSize();
+		auto entry = std::find_if(entries.begin(), entries.end(),
+			[&](const ImageCacheIndexEntry& e) { return e.key == keys[image]; });
+		if (entry == entries.end())
+			entries.push_back({ keys[image], size, generation });
+		else
+			*entry = { keys[image], size, generation };
+	}
+
+	uint64_t total = 0;
+	for (const ImageCacheIndexEntry& entry : entries)
+		total += entry.size;
+	std::sort(entries.begin(), entries.end(),
+		[](const ImageCacheIndexEntry& a, const ImageCacheIndexEntry& b) { return a.lastUse > b.lastUse; });
+	size_t evicted = 0;
+	while (total > limit && !entries.empty() && entries.back().lastUse != generation)
+	{
+		std::string cachePath = GetImageCachePath(cacheFolder, entries.back().key);
+		if (std::remove(cachePath.c_str()) != 0 && std::ifstream(cachePath).good())
+			break; // the oldest can't go yet, keep the order intact
+		total -= entries.back().size;
+		entries.pop_back();
+		++evicted;
+	}
+	if (evicted)
+		std::cout << "Evicted " << evicted << " image cache entries, " << total << " bytes kept" << std::endl;
+
+	header.entryCount = static_cast<uint32_t>(entries.size());
+	memcpy(header.magic, IMAGE_CACHE_INDEX_MAGIC, sizeof(header.magic));
+	std::string tempPath = indexPath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ImageCacheIndexEntry));
+		if (!file)
+			return;
+	}
+	std::remove(indexPath.c_str());
+	std::rename(tempPath.c_str(), indexPath.c_str());
+}
+
+#endif
@@ -0,0 +1,408 @@
+// Requires ContentHash.h, MappedFile.h, FileService.h, GLBLoader.h, SceneGeometry.h, VertexQuantization.h & TextureLoader.h
+// Cooked mesh cache: a versioned binary image of a SceneGeometry that can be mapped and
+// uploaded without touching tinygltf. Every section starts on a MESH_CACHE_ALIGNMENT boundary
+// so streams can be handed to the GPU straight out of the mapping.
+// A cache is only used while the hashes of all the files it was cooked from still match.
+// It also records where every image's encoded bytes are, so textured models load without the glTF too.
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <fstream>
+
+const char MESH_CACHE_MAGIC[4] = { 'G', 'M', 'S', 'H' };
+const uint32_t MESH_CACHE_VERSION = 8;
+const uint64_t MESH_CACHE_ALIGNMENT = 256;
+const uint32_t MESH_CACHE_MAX_PATH = 248;
+
+enum MESH_CACHE_SECTION
+{
+	MESH_CACHE_SECTION_POSITION = 0, // vertex streams share the GEOMETRY_STREAM order
+	MESH_CACHE_SECTION_NORMAL,
+	MESH_CACHE_SECTION_TEXCOORD,
+	MESH_CACHE_SECTION_TANGENT,
+	MESH_CACHE_SECTION_INDICES,
+	MESH_CACHE_SECTION_DRAWS,
+	MESH_CACHE_SECTION_BOUNDS,
+	MESH_CACHE_SECTION_TRANSFORMS,
+	MESH_CACHE_SECTION_MATERIALS,
+	MESH_CACHE_SECTION_DEPENDENCIES,
+	MESH_CACHE_SECTION_IMAGES, // indexed like the model's images
+	MESH_CACHE_SECTION_COUNT
+};
+
+struct MeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t sectionCount;
+	uint32_t vertexFormat; // GEOMETRY_VERTEX_FORMAT of the streams
+	uint32_t narrowIndexCount; // 16-bit indices at the start of the index section
+	uint32_t indexPacking; // INDEX_PACKING the geometry was built with
+	uint32_t modelQuantized; // the model uses KHR_mesh_quantization, so its streams are quantized whatever was asked for
+};
+
+struct MeshCacheSection
+{
+	uint64_t offset;
+	uint64_t size;
+	uint32_t stride; // element stride for streams and tables
+	uint32_t count; // element count
+};
+
+// A file the cache was cooked from, path is relative to the source model's folder
+struct MeshCacheDependency
+{
+	uint64_t hash;
+	char path[MESH_CACHE_MAX_PATH];
+};
+
+// An ImageLocation, path is empty when the image can only be read out of the parsed glTF
+struct MeshCacheImage
+{
+	uint64_t offset;
+	uint64_t size;
+	char path[MESH_CACHE_MAX_PATH - 8];
+};
+
+// Sizes are fixed by the mesh cache file format
+static_assert(sizeof(MeshCacheHeader) == 36, "MeshCacheHeader size");
+static_assert(sizeof(MeshCacheSection) == 24, "MeshCacheSection size");
+static_assert(sizeof(MeshCacheDependency) == 256, "MeshCacheDependency size");
+static_assert(sizeof(MeshCacheImage) == 256, "MeshCacheImage size");
+
+// "../Models/Bebe.glb" -> "../Models/Bebe.meshcache"
+std::string GetMeshCachePath(const std::string& sourcePath)
+{
+	size_t dot = sourcePath.find_last_of('.');
+	size_t slash = sourcePath.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return sourcePath + ".meshcache";
+	return sourcePath.substr(0, dot) + ".meshcache";
+}
+
+// Every file whose bytes end up in the cooked geometry: the model itself plus external buffers
+bool CollectMeshCacheDependencies(const std::string& sourcePath, const tinygltf::Model& model,
+	std::vector<MeshCacheDependency>& dependencies, std::string& err)
+{
+	std::string baseDir = sourcePath.substr(0, sourcePath.find_last_of("/\\") + 1);
+	std::vector<std::string> files(1, sourcePath.substr(baseDir.size()));
+	for (const tinygltf::Buffer& buffer : model.buffers)
+	{
+		if (!buffer.uri.empty() && buffer.uri.compare(0, 5, "data:") != 0)
+			files.push_back(buffer.uri);
+	}
+
+	dependencies.clear();
+	for (const std::string& file : files)
+	{
+		MeshCacheDependency dependency = {};
+		if (file.size() >= MESH_CACHE_MAX_PATH || !HashFile(baseDir + file, dependency.hash))
+		{
+			err = "Unable to hash mesh cache dependency \"" + file + "\"";
+			return false;
+		}
+		memcpy(dependency.path, file.c_str(), file.size());
+		dependencies.push_back(dependency);
+	}
+	return true;
+}
+
+bool WriteMeshCache(const std::string& cachePath, const SceneGeometry& geometry, INDEX_PACKING packing,
+	bool modelQuantized, const std::vector<MeshCacheDependency>& dependencies, const std::vector<ImageLocation>& locations)
+{
+	std::vector<MeshCacheImage> images(locations.size(), MeshCacheImage());
+	for (size_t i = 0; i < locations.size(); ++i)
+	{
+		// a path that doesn't fit is left empty, that image is read out of the glTF
+		images[i].offset = locations[i].offset;
+		images[i].size = locations[i].size;
+		if (locations[i].path.size() < sizeof(images[i].path))
+			memcpy(images[i].path, locations[i].path.c_str(), locations[i].path.size());
+	}
+
+	struct SectionSource { const void* data; uint64_t size; uint32_t stride; uint32_t count; };
+	SectionSource sources[MESH_CACHE_SECTION_COUNT];
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		sources[i] = { geometry.vertexStreams[i].data, geometry.vertexStreams[i].size,
+			geometry.vertexStrides[i], geometry.vertexCount };
+	}
+	sources[MESH_CACHE_SECTION_INDICES] = { geometry.indices.data, geometry.indices.size,
+		0, geometry.indexCount }; // mixed widths, see narrowIndexCount
+	sources[MESH_CACHE_SECTION_DRAWS] = { geometry.draws.data(), geometry.draws.size() * sizeof(GeometryDraw),
+		sizeof(GeometryDraw), static_cast<uint32_t>(geometry.draws.size()) };
+	sources[MESH_CACHE_SECTION_BOUNDS] = { geometry.bounds.data(), geometry.bounds.size() * sizeof(GeometryBounds),
+		sizeof(GeometryBounds), static_cast<uint32_t>(geometry.bounds.size()) };
+	sources[MESH_CACHE_SECTION_TRANSFORMS] = { geometry.transforms.data(), geometry.transforms.size() * sizeof(GeometryTransform),
+		sizeof(GeometryTransform), static_cast<uint32_t>(geometry.transforms.size()) };
+	sources[MESH_CACHE_SECTION_MATERIALS] = { geometry.materials.data(), geometry.materials.size() * sizeof(GeometryMaterial),
+		sizeof(GeometryMaterial), static_cast<uint32_t>(geometry.materials.size()) };
+	sources[MESH_CACHE_SECTION_DEPENDENCIES] = { dependencies.data(), dependencies.size() * sizeof(MeshCacheDependency),
+		sizeof(MeshCacheDependency), static_cast<uint32_t>(dependencies.size()) };
+	sources[MESH_CACHE_SECTION_IMAGES] = { images.data(), images.size() * sizeof(MeshCacheImage),
+		sizeof(MeshCacheImage), static_cast<uint32_t>(images.size()) };
+
+	MeshCacheHeader header = {};
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.vertexCount = geometry.vertexCount;
+	header.indexCount = geometry.indexCount;
+	header.sectionCount = MESH_CACHE_SECTION_COUNT;
+	header.vertexFormat = geometry.vertexFormat;
+	header.narrowIndexCount = geometry.narrowIndexCount;
+	header.indexPacking = packing;
+	header.modelQuantized = modelQuantized;
+
+	MeshCacheSection sections[MESH_CACHE_SECTION_COUNT];
+	uint64_t cursor = sizeof(header) + sizeof(sections);
+	for (int i = 0; i < MESH_CACHE_SECTION_COUNT; ++i)
+	{
+		cursor = (cursor + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+		sections[i] = { cursor, sources[i].size, sources[i].stride, sources[i].count };
+		cursor += sources[i].size;
+	}
+
+	// write to a temporary name first so a crash never leaves a truncated cache behind
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+		static const char zeros[MESH_CACHE_ALIGNMENT] = {};
+		for (int i = 0; i < MESH_CACHE_SECTION_COUNT; ++i)
+		{
+			file.write(zeros, static_cast<std::streamsize>(sections[i].offset - static_cast<uint64_t>(file.tellp())));
+			if (sources[i].size > 0)
+				file.write(static_cast<const char*>(sources[i].data), static_cast<std::streamsize>(sources[i].size));
+		}
+		if (!file)
+			return false;
+	}
+	std::remove(cachePath.c_str());
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+// A table section holds "count" elements of "elementSize" bytes
+bool IsMeshCacheTableValid(const MeshCacheSection& section, size_t elementSize)
+{
+	return section.stride == elementSize && uint64_t(section.count) * elementSize <= section.size;
+}
+
+// Every material samples images the cache has
+bool AreMeshCacheMaterialsValid(const std::vector<GeometryMaterial>& materials, uint32_t imageCount)
+{
+	for (const GeometryMaterial& material : materials)
+	{
+		if (material.baseColorImage < -1 || material.baseColorImage >= static_cast<int64_t>(imageCount) ||
+			material.metallicRoughnessImage < -1 || material.metallicRoughnessImage >= static_cast<int64_t>(imageCount))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Every draw reads inside its index section and the vertex streams
+bool AreMeshCacheDrawsValid(const std::vector<GeometryDraw>& draws, const MeshCacheHeader& header, uint32_t materialCount)
+{
+	for (const GeometryDraw& draw : draws)
+	{
+		uint64_t sectionCount = draw.indexSize == sizeof(uint16_t) ? header.narrowIndexCount :
+			draw.indexSize == sizeof(uint32_t) ? header.indexCount - header.narrowIndexCount : 0;
+		if (uint64_t(draw.firstIndex) + draw.indexCount > sectionCount || draw.vertexOffset < 0 ||
+			uint64_t(draw.vertexOffset) + draw.vertexCount > header.vertexCount ||
+			draw.material < -1 || draw.material >= static_cast<int64_t>(materialCount))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Maps "cachePath" and points "geometry" into it, "locations" receives where the model's images are.
+// Fails (leaving "mapping" closed) when the cache is missing, was written by another version or index
+// packing, holds quantized streams "quantize" didn't ask for, or any file it was cooked from has changed.
+// "dependencyPaths" (when given) receives the paths of those files.
+bool ReadMeshCache(const std::string& cachePath, const std::string& sourcePath, INDEX_PACKING packing,
+	bool quantize, MappedFile& mapping, SceneGeometry& geometry, std::vector<ImageLocation>& locations, std::string& err,
+	std::vector<std::string>* dependencyPaths = nullptr)
+{
+	if (!mapping.Open(cachePath.c_str()))
+	{
+		err = "no cache";
+		return false;
+	}
+
+	const unsigned char* bytes = mapping.Data();
+	MeshCacheHeader header;
+	MeshCacheSection sections[MESH_CACHE_SECTION_COUNT];
+	if (mapping.Size() < sizeof(header) + sizeof(sections))
+	{
+		err = "truncated header";
+		mapping.Close();
+		return false;
+	}
+	memcpy(&header, bytes, sizeof(header));
+	memcpy(sections, bytes + sizeof(header), sizeof(sections));
+
+	if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != MESH_CACHE_VERSION || header.sectionCount != MESH_CACHE_SECTION_COUNT ||
+		header.vertexFormat > GEOMETRY_VERTEX_FORMAT_QUANTIZED)
+	{
+		err = "incompatible version";
+		mapping.Close();
+		return false;
+	}
+	if (header.indexPacking != static_cast<uint32_t>(packing) || header.narrowIndexCount > header.indexCount)
+	{
+		err = std::string("cooked with \"") + (header.indexPacking < INDEX_PACKING_COUNT ?
+			INDEX_PACKING_NAMES[header.indexPacking] : "unknown") + "\" index packing";
+		mapping.Close();
+		return false;
+	}
+	if (header.vertexFormat == GEOMETRY_VERTEX_FORMAT_QUANTIZED && !quantize && !header.modelQuantized)
+	{
+		err = "cooked with quantized vertices";
+		mapping.Close();
+		return false;
+	}
+	for (const MeshCacheSection& section : sections)
+	{
+		if (section.offset > mapping.Size() || section.size > mapping.Size() - section.offset)
+		{
+			err = "truncated section";
+			mapping.Close();
+			return false;
+		}
+	}
+
+	// nothing past here trusts a count the sections don't have room for
+	const MeshCacheSection& indexSection = sections[MESH_CACHE_SECTION_INDICES];
+	const MeshCacheSection& dependencySection = sections[MESH_CACHE_SECTION_DEPENDENCIES];
+	const MeshCacheSection& draws = sections[MESH_CACHE_SECTION_DRAWS];
+	const MeshCacheSection& bounds = sections[MESH_CACHE_SECTION_BOUNDS];
+	const MeshCacheSection& transforms = sections[MESH_CACHE_SECTION_TRANSFORMS];
+	const MeshCacheSection& materials = sections[MESH_CACHE_SECTION_MATERIALS];
+	const MeshCacheSection& images = sections[MESH_CACHE_SECTION_IMAGES];
+	bool valid = IsMeshCacheTableValid(dependencySection, sizeof(MeshCacheDependency)) &&
+		IsMeshCacheTableValid(images, sizeof(MeshCacheImage)) &&
+		IsMeshCacheTableValid(draws, sizeof(GeometryDraw)) && IsMeshCacheTableValid(bounds, sizeof(GeometryBounds)) &&
+		IsMeshCacheTableValid(transforms, sizeof(GeometryTransform)) &&
+		IsMeshCacheTableValid(materials, sizeof(GeometryMaterial)) &&
+		bounds.count == draws.count && transforms.count == draws.count;
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+		valid = valid && sections[i].size == uint64_t(header.vertexCount) * sections[i].stride;
+	uint64_t wideIndexOffset = (uint64_t(header.narrowIndexCount) * sizeof(uint16_t) + 3) & ~uint64_t(3); // GetWideIndexOffset
+	valid = valid && wideIndexOffset + uint64_t(header.indexCount - header.narrowIndexCount) * sizeof(uint32_t) <= indexSection.size;
+	std::vector<GeometryDraw> drawTable;
+	std::vector<GeometryMaterial> materialTable;
+	if (valid)
+	{
+		drawTable.resize(draws.count);
+		memcpy(drawTable.data(), bytes + draws.offset, drawTable.size() * sizeof(GeometryDraw));
+		materialTable.resize(materials.count);
+		memcpy(materialTable.data(), bytes + materials.offset, materialTable.size() * sizeof(GeometryMaterial));
+		valid = AreMeshCacheDrawsValid(drawTable, header, materials.count) &&
+			AreMeshCacheMaterialsValid(materialTable, images.count);
+	}
+	if (!valid)
+	{
+		err = "corrupt sections";
+		mapping.Close();
+		return false;
+	}
+
+	// stale if any dependency changed since it was cooked
+	std::string baseDir = sourcePath.substr(0, sourcePath.find_last_of("/\\") + 1);
+	if (dependencyPaths)
+		dependencyPaths->clear();
+	for (uint32_t i = 0; i < dependencySection.count; ++i)
+	{
+		MeshCacheDependency dependency;
+		memcpy(&dependency, bytes + dependencySection.offset + i * sizeof(dependency), sizeof(dependency));
+		dependency.path[MESH_CACHE_MAX_PATH - 1] = '\0';
+
+		uint64_t hash;
+		if (!HashFile(baseDir + dependency.path, hash) || hash != dependency.hash)
+		{
+			err = std::string("stale (\"") + dependency.path + "\" changed)";
+			mapping.Close();
+			return false;
+		}
+		if (dependencyPaths)
+			dependencyPaths->push_back(baseDir + dependency.path);
+	}
+
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		geometry.vertexStreams[i].data = bytes + sections[i].offset;
+		geometry.vertexStreams[i].size = static_cast<size_t>(sections[i].size);
+		geometry.vertexStrides[i] = sections[i].stride;
+	}
+	geometry.indices.data = bytes + indexSection.offset;
+	geometry.indices.size = static_cast<size_t>(indexSection.size);
+	geometry.narrowIndexCount = header.narrowIndexCount;
+	geometry.vertexCount = header.vertexCount;
+	geometry.indexCount = header.indexCount;
+	geometry.vertexFormat = header.vertexFormat;
+
+	// the small tables are copied out so they outlive the mapping
+	geometry.draws.swap(drawTable);
+	geometry.materials.swap(materialTable);
+	geometry.bounds.resize(bounds.count);
+	geometry.transforms.resize(transforms.count);
+	memcpy(geometry.bounds.data(), bytes + bounds.offset, bounds.count * sizeof(GeometryBounds));
+	memcpy(geometry.transforms.data(), bytes + transforms.offset, transforms.count * sizeof(GeometryTransform));
+
+	locations.assign(images.count, ImageLocation());
+	for (uint32_t i = 0; i < images.count; ++i)
+	{
+		MeshCacheImage image;
+		memcpy(&image, bytes + images.offset + i * sizeof(image), sizeof(image));
+		image.path[sizeof(image.path) - 1] = '\0';
+		locations[i].path = image.path;
+		locations[i].offset = image.offset;
+		locations[i].size = image.size;
+	}
+	return true;
+}
+
+// Offline cook step: loads a glTF/GLB and writes its mesh cache next to it.
+// "quantize" stores the compact vertex format, models using KHR_mesh_quantization always do.
+bool CookMeshCache(const std::string& sourcePath, bool quantize, INDEX_PACKING packing, std::string& err)
+{
+	tinygltf::TinyGLTF loader;
+	tinygltf::Model model;
+	std::vector<FileView> files;
+	std::vector<BufferSpan> spans;
+	std::string warn;
+	if (!LoadModelFile(loader, sourcePath, model, files, spans, err, warn))
+		return false;
+
+	SceneGeometry geometry;
+	std::vector<MeshCacheDependency> dependencies;
+	if (!BuildSceneGeometry(model, spans, geometry, err, packing) ||
+		!CollectMeshCacheDependencies(sourcePath, model, dependencies, err))
+	{
+		return false;
+	}
+	std::vector<ImageLocation> locations;
+	GetImageLocations(model, spans, files, sourcePath, locations);
+	bool modelQuantized = ModelUsesMeshQuantization(model);
+	if (quantize || modelQuantized)
+		QuantizeSceneGeometry(geometry);
+
+	if (!WriteMeshCache(GetMeshCachePath(sourcePath), geometry, packing, modelQuantized, dependencies, locations))
+	{
+		err = "Unable to write \"" + GetMeshCachePath(sourcePath) + "\"";
+		return false;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,309 @@
+// Requires ScratchArena.h
+// Index/vertex reordering applied to every primitive when a model is packed (and therefore cooked).
+// 1. OptimizeVertexCache: Forsyth style greedy triangle ordering for the post-transform cache
+// 2. OptimizeOverdraw: splits that order into clusters and draws outward facing clusters first
+// 3. RemapVertexFetch: renumbers vertices in first use order so vertex fetch walks memory linearly
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <algorithm>
+#include <cmath>
+
+const unsigned int VERTEX_CACHE_SCORE_SIZE = 32; // LRU size the greedy ordering scores against
+const unsigned int VERTEX_CACHE_ANALYZE_SIZE = 16; // FIFO size ACMR/ATVR are measured with
+const float OVERDRAW_ACMR_THRESHOLD = 1.05f; // overdraw order may cost at most 5% of the cache gain
+
+// Totals of a FIFO cache simulation, summable across primitives
+struct VertexCacheStats
+{
+	uint64_t transformed = 0; // cache misses
+	uint64_t triangles = 0;
+	uint64_t vertices = 0;
+
+	float ACMR() const { return triangles ? float(transformed) / triangles : 0.0f; } // misses per triangle, 0.5 is ideal
+	float ATVR() const { return vertices ? float(transformed) / vertices : 0.0f; } // misses per vertex, 1.0 is ideal
+
+	void operator+=(const VertexCacheStats& other)
+	{
+		transformed += other.transformed;
+		triangles += other.triangles;
+		vertices += other.vertices;
+	}
+};
+
+VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+	ScratchArena& scratch, unsigned int cacheSize = VERTEX_CACHE_ANALYZE_SIZE)
+{
+	VertexCacheStats stats;
+	stats.triangles = indexCount / 3;
+	stats.vertices = vertexCount;
+
+	// a vertex is cached while fewer than "cacheSize" misses happened since it was loaded
+	ScratchVector<uint64_t> loadedAt(vertexCount, 0, scratch);
+	uint64_t misses = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		uint32_t v = indices[i];
+		if (loadedAt[v] == 0 || misses - loadedAt[v] + 1 > cacheSize)
+			loadedAt[v] = ++misses;
+	}
+	stats.transformed = misses;
+	return stats;
+}
+
+// Forsyth's vertex score: recently used vertices and vertices with few remaining triangles win
+float VertexCacheScore(int cachePosition, unsigned int remainingTriangles)
+{
+	if (remainingTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+			score = 0.75f; // the last triangle's vertices, favouring them would just strip
+		else
+			score = powf(1.0f - float(cachePosition - 3) / (VERTEX_CACHE_SCORE_SIZE - 3), 1.5f);
+	}
+	return score + 2.0f / sqrtf(float(remainingTriangles));
+}
+
+void OptimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount,
+	ScratchArena& scratch)
+{
+	size_t triangleCount = indexCount / 3;
+
+	// vertex -> triangles adjacency in one flat array
+	ScratchVector<uint32_t> adjacencyOffsets(vertexCount + 1, 0, scratch);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+		++adjacencyOffsets[indices[i] + 1];
+	for (size_t v = 0; v < vertexCount; ++v)
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+	ScratchVector<uint32_t> adjacency(triangleCount * 3, 0, scratch);
+	ScratchVector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1, scratch);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		for (int k = 0; k < 3; ++k)
+			adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+	}
+
+	ScratchVector<unsigned int> remaining(vertexCount, 0, scratch);
+	ScratchVector<int> cachePosition(vertexCount, -1, scratch);
+	ScratchVector<float> vertexScore(vertexCount, 0.0f, scratch);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		remaining[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+		vertexScore[v] = VertexCacheScore(-1, remaining[v]);
+	}
+
+	ScratchVector<float> triangleScore(triangleCount, 0.0f, scratch);
+	ScratchVector<bool> emitted(triangleCount, false, scratch);
+	for (size_t t = 0; t < triangleCount; ++t)
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+	ScratchVector<uint32_t> cache(scratch), nextCache(scratch);
+	cache.reserve(VERTEX_CACHE_SCORE_SIZE + 3);
+	nextCache.reserve(VERTEX_CACHE_SCORE_SIZE + 3);
+	size_t inputCursor = 0; // dead ends restart from the first triangle not emitted yet
+	int64_t best = triangleCount ? 0 : -1;
+
+	for (size_t out = 0; out < triangleCount; ++out)
+	{
+		if (best < 0)
+		{
+			while (emitted[inputCursor])
+				++inputCursor;
+			best = static_cast<int64_t>(inputCursor);
+		}
+
+		uint32_t triangle = static_cast<uint32_t>(best);
+		emitted[triangle] = true;
+		const uint32_t* corners = indices + size_t(triangle) * 3;
+		memcpy(destination + out * 3, corners, sizeof(uint32_t) * 3);
+
+		// the new triangle's vertices go to the front of the LRU
+		nextCache.clear();
+		for (int k = 0; k < 3; ++k)
+		{
+			if (std::find(nextCache.begin(), nextCache.end(), corners[k]) == nextCache.end()) // degenerate triangles
+				nextCache.push_back(corners[k]);
+		}
+		for (uint32_t v : cache)
+		{
+			if (v != corners[0] && v != corners[1] && v != corners[2])
+				nextCache.push_back(v);
+		}
+		for (size_t i = VERTEX_CACHE_SCORE_SIZE; i < nextCache.size(); ++i) // pushed out, back to a valence only score
+		{
+			uint32_t v = nextCache[i];
+			cachePosition[v] = -1;
+			float score = VertexCacheScore(-1, remaining[v]);
+			const uint32_t* list = adjacency.data() + adjacencyOffsets[v];
+			for (uint32_t j = 0; j < remaining[v]; ++j)
+				triangleScore[list[j]] += score - vertexScore[v];
+			vertexScore[v] = score;
+		}
+		nextCache.resize(std::min<size_t>(nextCache.size(), VERTEX_CACHE_SCORE_SIZE));
+		cache.swap(nextCache);
+
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = corners[k];
+			--remaining[v];
+			uint32_t* list = adjacency.data() + adjacencyOffsets[v];
+			for (uint32_t i = 0; i < remaining[v] + 1; ++i) // keep only live triangles in the list
+			{
+				if (list[i] == triangle)
+				{
+					std::swap(list[i], list[remaining[v]]);
+					break;
+				}
+			}
+		}
+
+		// rescore everything in the cache and pick the best live triangle touching it
+		best = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			uint32_t v = cache[i];
+			cachePosition[v] = static_cast<int>(i);
+			float score = VertexCacheScore(static_cast<int>(i), remaining[v]);
+			float delta = score - vertexScore[v];
+			vertexScore[v] = score;
+			const uint32_t* list = adjacency.data() + adjacencyOffsets[v];
+			for (uint32_t j = 0; j < remaining[v]; ++j)
+				triangleScore[list[j]] += delta;
+		}
+		for (uint32_t v : cache)
+		{
+			const uint32_t* list = adjacency.data() + adjacencyOffsets[v];
+			for (uint32_t j = 0; j < remaining[v]; ++j)
+			{
+				if (triangleScore[list[j]] > bestScore)
+				{
+					bestScore = triangleScore[list[j]];
+					best = list[j];
+				}
+			}
+		}
+	}
+}
+
+// Sander et al.'s linear overdraw ordering on top of a cache optimized index buffer. Clusters end
+// where the cache simulation would flush, then outward facing clusters are moved to the front.
+void OptimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount,
+	const float* positions, size_t vertexCount, ScratchArena& scratch, float threshold = OVERDRAW_ACMR_THRESHOLD)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	// hard boundaries: triangles whose three vertices all miss the cache
+	ScratchVector<size_t> clusters(scratch);
+	{
+		ScratchVector<uint64_t> loadedAt(vertexCount, 0, scratch);
+		uint64_t misses = 0;
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			int triangleMisses = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t v = indices[t * 3 + k];
+				if (loadedAt[v] == 0 || misses - loadedAt[v] + 1 > VERTEX_CACHE_ANALYZE_SIZE)
+				{
+					loadedAt[v] = ++misses;
+					++triangleMisses;
+				}
+			}
+			if (t == 0 || triangleMisses == 3)
+				clusters.push_back(t);
+		}
+	}
+	clusters.push_back(triangleCount);
+
+	// mesh centroid, then each cluster's area weighted centroid & normal
+	float meshCenter[3] = {};
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		for (int c = 0; c < 3; ++c)
+			meshCenter[c] += positions[v * 3 + c] / vertexCount;
+	}
+
+	size_t clusterCount = clusters.size() - 1;
+	ScratchVector<std::pair<float, size_t>> order(clusterCount, std::make_pair(0.0f, size_t(0)), scratch);
+	for (size_t i = 0; i < clusterCount; ++i)
+	{
+		float center[3] = {}, normal[3] = {}, area = 0.0f;
+		for (size_t t = clusters[i]; t < clusters[i + 1]; ++t)
+		{
+			const float* a = positions + size_t(indices[t * 3]) * 3;
+			const float* b = positions + size_t(indices[t * 3 + 1]) * 3;
+			const float* c = positions + size_t(indices[t * 3 + 2]) * 3;
+			float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+			float w = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]); // twice the area
+			for (int k = 0; k < 3; ++k)
+			{
+				center[k] += (a[k] + b[k] + c[k]) / 3.0f * w;
+				normal[k] += n[k];
+			}
+			area += w;
+		}
+		float metric = 0.0f;
+		if (area > 0.0f)
+		{
+			for (int k = 0; k < 3; ++k)
+				metric += (center[k] / area - meshCenter[k]) * normal[k];
+			metric /= area; // compare directions, not sizes
+		}
+		order[i] = std::make_pair(-metric, i);
+	}
+	std::stable_sort(order.begin(), order.end());
+
+	size_t out = 0;
+	for (const std::pair<float, size_t>& cluster : order)
+	{
+		size_t first = clusters[cluster.second], last = clusters[cluster.second + 1];
+		memcpy(destination + out * 3, indices + first * 3, (last - first) * 3 * sizeof(uint32_t));
+		out += last - first;
+	}
+
+	// reordering clusters can only lose cache hits at their seams, keep the input if it lost too many
+	VertexCacheStats before = AnalyzeVertexCache(indices, triangleCount * 3, vertexCount, scratch);
+	VertexCacheStats after = AnalyzeVertexCache(destination, triangleCount * 3, vertexCount, scratch);
+	if (after.ACMR() > before.ACMR() * threshold)
+		memcpy(destination, indices, triangleCount * 3 * sizeof(uint32_t));
+}
+
+// Renumbers vertices in the order the index buffer first touches them (unused ones go last).
+// Rewrites "indices" in place and fills "remap" (vertexCount entries) with old -> new vertex numbers.
+void RemapVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t* remap)
+{
+	const uint32_t UNUSED = ~0u;
+	std::fill(remap, remap + vertexCount, UNUSED);
+	uint32_t next = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		if (remap[indices[i]] == UNUSED)
+			remap[indices[i]] = next++;
+		indices[i] = remap[indices[i]];
+	}
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		if (remap[v] == UNUSED)
+			remap[v] = next++;
+	}
+}
+
+// Moves "count" elements of "stride" bytes to their remapped slots
+void ApplyVertexRemap(unsigned char* vertices, uint32_t stride, size_t count, const uint32_t* remap,
+	ScratchArena& scratch)
+{
+	ScratchVector<unsigned char> source(vertices, vertices + size_t(stride) * count, scratch);
+	for (size_t v = 0; v < count; ++v)
+		memcpy(vertices + size_t(remap[v]) * stride, source.data() + v * stride, stride);
+}
+
+#endif
@@ -0,0 +1,121 @@
+// Requires Vulkan, ContentHash.h, MappedFile.h & CacheFolder.h
+// Persists the driver's VkPipelineCache between runs. The blob is wrapped in a small header
+// recording which device and driver produced it, a blob from anything else is discarded
+// instead of being handed to the driver.
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include <fstream>
+
+const char PIPELINE_CACHE_MAGIC[4] = { 'P', 'S', 'O', 'C' };
+const uint32_t PIPELINE_CACHE_VERSION = 1;
+
+struct PipelineCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	uint32_t reserved;
+	uint64_t dataHash;
+	uint64_t dataSize;
+};
+
+static_assert(sizeof(PipelineCacheHeader) == 56, "PipelineCacheHeader is part of the pipeline cache format");
+
+PipelineCacheHeader MakePipelineCacheHeader(const VkPhysicalDeviceProperties& properties)
+{
+	PipelineCacheHeader header = {};
+	memcpy(header.magic, PIPELINE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = PIPELINE_CACHE_VERSION;
+	header.vendorID = properties.vendorID;
+	header.deviceID = properties.deviceID;
+	header.driverVersion = properties.driverVersion;
+	memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	return header;
+}
+
+// Creates the pipeline cache, seeded from "cachePath" when it was written by this exact device & driver
+VkPipelineCache LoadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::string& cachePath)
+{
+	MappedFile file;
+	const void* initialData = nullptr;
+	size_t initialSize = 0;
+	if (!cachePath.empty() && file.Open(cachePath.c_str()) && file.Size() > sizeof(PipelineCacheHeader))
+	{
+		PipelineCacheHeader expected = MakePipelineCacheHeader(properties);
+		PipelineCacheHeader header;
+		memcpy(&header, file.Data(), sizeof(header));
+		const unsigned char* data = file.Data() + sizeof(header);
+		size_t dataSize = file.Size() - sizeof(header);
+
+		// the driver's own header (VkPipelineCacheHeaderVersionOne) must agree with ours as well
+		VkPipelineCacheHeaderVersionOne driverHeader = {};
+		if (dataSize >= sizeof(driverHeader))
+			memcpy(&driverHeader, data, sizeof(driverHeader));
+
+		if (memcmp(&header, &expected, offsetof(PipelineCacheHeader, dataHash)) == 0 &&
+			header.dataSize == dataSize && HashBytes(data, dataSize) == header.dataHash &&
+			driverHeader.vendorID == properties.vendorID && driverHeader.deviceID == properties.deviceID &&
+			memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0)
+		{
+			initialData = data;
+			initialSize = dataSize;
+		}
+		else
+			std::cout << "Pipeline cache \"" << cachePath << "\" is damaged or from another device/driver, ignoring it" << std::endl;
+	}
+
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = initialSize;
+	createInfo.pInitialData = initialData;
+
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	if (vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache) != VK_SUCCESS && initialSize > 0)
+	{
+		initialSize = 0; // a driver may still reject data it can't use, start empty
+		createInfo.initialDataSize = 0;
+		createInfo.pInitialData = nullptr;
+		vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache);
+	}
+	if (initialSize > 0)
+		std::cout << "Loaded pipeline cache \"" << cachePath << "\" (" << initialSize << " bytes)" << std::endl;
+	return pipelineCache;
+}
+
+// Writes the driver's current blob to "cachePath", through a temporary file
+bool SavePipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, VkPipelineCache pipelineCache,
+	const std::string& cachePath)
+{
+	size_t dataSize = 0;
+	if (cachePath.empty() || pipelineCache == VK_NULL_HANDLE ||
+		vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+	{
+		return false;
+	}
+	std::vector<unsigned char> data(dataSize);
+	if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+		return false;
+
+	PipelineCacheHeader header = MakePipelineCacheHeader(properties);
+	header.dataHash = HashBytes(data.data(), dataSize);
+	header.dataSize = dataSize;
+
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(dataSize));
+		if (!file)
+			return false;
+	}
+	std::remove(cachePath.c_str());
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+#endif
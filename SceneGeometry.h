@@ -0,0 +1,1037 @@
+// Requires TinyGLTF, Gateware (SYSTEM), GLBLoader.h, ScratchArena.h & MeshOptimizer.h
+// CPU side description of everything the renderer uploads for a model.
+// It is produced either from a glTF file or straight out of a cooked mesh cache,
+// so the upload code never needs to know where the bytes came from.
+#ifndef SCENE_GEOMETRY_H
+#define SCENE_GEOMETRY_H
+
+#include <algorithm>
+#include <cfloat>
+#include <memory>
+#include <thread>
+
+enum GEOMETRY_STREAM
+{
+	GEOMETRY_STREAM_POSITION = 0,
+	GEOMETRY_STREAM_NORMAL,
+	GEOMETRY_STREAM_TEXCOORD,
+	GEOMETRY_STREAM_TANGENT,
+	GEOMETRY_STREAM_COUNT
+};
+
+// Every primitive is decoded into the pool as tightly packed floats of these sizes.
+// A stream is also the shader location its attribute is bound to.
+const uint32_t GEOMETRY_STREAM_COMPONENTS[GEOMETRY_STREAM_COUNT] = { 3, 3, 2, 4 };
+const char* const GEOMETRY_STREAM_SEMANTICS[GEOMETRY_STREAM_COUNT] = { "POSITION", "NORMAL", "TEXCOORD_0", "TANGENT" };
+const float GEOMETRY_STREAM_DEFAULTS[GEOMETRY_STREAM_COUNT][4] = { { 0, 0, 0 }, { 0, 1, 0 }, { 0, 0 }, { 1, 0, 0, 1 } };
+
+enum GEOMETRY_VERTEX_FORMAT
+{
+	GEOMETRY_VERTEX_FORMAT_FLOAT = 0, // GEOMETRY_STREAM_COMPONENTS floats per stream
+	GEOMETRY_VERTEX_FORMAT_QUANTIZED, // compact streams, see VertexQuantization.h
+};
+
+// How primitives pick their index width when the pool is packed
+enum INDEX_PACKING
+{
+	INDEX_PACKING_SOURCE = 0, // keep the accessor's width (8-bit indices widen to 16)
+	INDEX_PACKING_REPACK, // 16-bit whenever the primitive has at most 65536 vertices
+	INDEX_PACKING_SPLIT, // like REPACK, larger primitives are split into 16-bit sub-meshes
+	INDEX_PACKING_COUNT
+};
+
+const char* const INDEX_PACKING_NAMES[INDEX_PACKING_COUNT] = { "source", "repack", "split" };
+const uint32_t MAX_NARROW_INDEX_VERTICES = 0x10000;
+
+// One indexed draw out of the shared pool
+struct GeometryDraw
+{
+	uint32_t firstIndex; // counted from the start of the draw's index section
+	uint32_t indexCount;
+	int32_t vertexOffset;
+	uint32_t vertexCount;
+	int32_t material; // index into SceneGeometry::materials, -1 for the default material
+	uint32_t indexSize; // 2 or 4 bytes, selects the index section
+	uint32_t padding[2];
+};
+
+struct GeometryBounds
+{
+	float min[3];
+	float max[3];
+};
+
+// Node to world matrix of a draw, column major like glTF (and like the shaders read it)
+struct GeometryTransform
+{
+	float matrix[16];
+};
+
+struct GeometryMaterial
+{
+	float baseColorFactor[4];
+	float emissiveFactor[3];
+	float metallicFactor;
+	float roughnessFactor;
+	float alphaCutoff;
+	int32_t baseColorTexture; // glTF texture indices, -1 when unused
+	int32_t metallicRoughnessTexture;
+	int32_t normalTexture;
+	uint32_t doubleSided;
+	int32_t baseColorImage; // glTF images those textures sample, -1 when unused
+	int32_t metallicRoughnessImage;
+};
+
+// The layout of these structs is written to disk by MeshCache.h
+static_assert(sizeof(GeometryDraw) == 32, "GeometryDraw size");
+static_assert(sizeof(GeometryBounds) == 24, "GeometryBounds size");
+static_assert(sizeof(GeometryTransform) == 64, "GeometryTransform size");
+static_assert(sizeof(GeometryMaterial) == 64, "GeometryMaterial size");
+
+const GeometryTransform GEOMETRY_IDENTITY = { { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 } };
+
+struct SceneGeometry
+{
+	// streams point into whatever owns the bytes (the storage below or a mapped cache)
+	BufferSpan vertexStreams[GEOMETRY_STREAM_COUNT];
+	uint32_t vertexStrides[GEOMETRY_STREAM_COUNT] = {}; // 0 when no primitive has the attribute, see GEOMETRY_STREAM_DEFAULTS
+	BufferSpan indices; // the 16-bit section, then the 32-bit one at GetWideIndexOffset()
+	uint32_t narrowIndexCount = 0;
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0; // both sections
+	uint32_t vertexFormat = GEOMETRY_VERTEX_FORMAT_FLOAT;
+
+	std::vector<GeometryDraw> draws;
+	std::vector<GeometryBounds> bounds; // one per draw, in the draw's local space
+	std::vector<GeometryTransform> transforms; // one per draw
+	std::vector<GeometryMaterial> materials;
+
+	// the pool packed out of a glTF, empty when the spans point into a mesh cache
+	std::vector<unsigned char> streamStorage[GEOMETRY_STREAM_COUNT];
+	std::vector<unsigned char> indexStorage;
+};
+
+// Byte offset of the 32-bit index section, kept 4 byte aligned
+size_t GetWideIndexOffset(const SceneGeometry& geometry)
+{
+	return (size_t(geometry.narrowIndexCount) * sizeof(uint16_t) + 3) & ~size_t(3);
+}
+
+// Drops the vertex & index pool once it lives on the GPU, the draw table, bounds, transforms and
+// materials stay. Returns the bytes freed (the pool of a mapped cache is freed with its mapping).
+size_t ReleaseGeometryPool(SceneGeometry& geometry)
+{
+	size_t released = geometry.indexStorage.size();
+	std::vector<unsigned char>().swap(geometry.indexStorage);
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		released += geometry.streamStorage[i].size();
+		std::vector<unsigned char>().swap(geometry.streamStorage[i]);
+		geometry.vertexStreams[i] = BufferSpan();
+	}
+	geometry.indices = BufferSpan();
+	return released;
+}
+
+bool ParseIndexPacking(const std::string& name, INDEX_PACKING& packing)
+{
+	for (int i = 0; i < INDEX_PACKING_COUNT; ++i)
+	{
+		if (name == INDEX_PACKING_NAMES[i])
+		{
+			packing = static_cast<INDEX_PACKING>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Span covering "accessor" inside its buffer, or an empty span if it has no data or starts past its bufferView
+BufferSpan GetAccessorSpan(const tinygltf::Model& model, const std::vector<BufferSpan>& spans,
+	const tinygltf::Accessor& accessor, uint32_t& outStride)
+{
+	BufferSpan span;
+	outStride = 0;
+	if (accessor.bufferView < 0)
+		return span;
+
+	const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+	if (accessor.byteOffset > bufferView.byteLength)
+		return span; // the size below would underflow
+	outStride = static_cast<uint32_t>(accessor.ByteStride(bufferView));
+	span.data = spans[bufferView.buffer].data + bufferView.byteOffset + accessor.byteOffset;
+	span.size = std::min<size_t>(bufferView.byteLength - accessor.byteOffset, size_t(outStride) * accessor.count);
+	return span;
+}
+
+// One component of any glTF vertex component type, expanding normalized integers.
+// Plain integers (allowed by KHR_mesh_quantization) are converted as they are.
+bool ReadComponentFloat(const unsigned char* source, int componentType, bool normalized, float& value)
+{
+	switch (componentType)
+	{
+	case TINYGLTF_COMPONENT_TYPE_FLOAT: memcpy(&value, source, 4); return true;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: value = normalized ? *source / 255.0f : *source; return true;
+	case TINYGLTF_COMPONENT_TYPE_BYTE:
+	{
+		float v = *reinterpret_cast<const int8_t*>(source);
+		value = normalized ? std::max(v / 127.0f, -1.0f) : v;
+		return true;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+	{
+		uint16_t v;
+		memcpy(&v, source, 2);
+		value = normalized ? v / 65535.0f : v;
+		return true;
+	}
+	case TINYGLTF_COMPONENT_TYPE_SHORT:
+	{
+		int16_t v;
+		memcpy(&v, source, 2);
+		value = normalized ? std::max(v / 32767.0f, -1.0f) : v;
+		return true;
+	}
+	}
+	return false;
+}
+
+// One glTF index of any index component type
+bool ReadComponentIndex(const unsigned char* source, int componentType, uint32_t& index)
+{
+	switch (componentType)
+	{
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: index = *source; return true;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, source, 2); index = v; } return true;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: memcpy(&index, source, 4); return true;
+	}
+	return false;
+}
+
+// The elements a sparse accessor overrides ("targets") and the tightly packed values replacing them
+bool GetSparseAccessor(const tinygltf::Model& model, const std::vector<BufferSpan>& spans,
+	const tinygltf::Accessor& accessor, size_t elementSize, ScratchVector<uint32_t>& targets, BufferSpan& values)
+{
+	const auto& sparse = accessor.sparse;
+	int indexSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(sparse.indices.componentType));
+	if (sparse.count < 0 || indexSize <= 0 ||
+		sparse.indices.bufferView < 0 || static_cast<size_t>(sparse.indices.bufferView) >= model.bufferViews.size() ||
+		sparse.values.bufferView < 0 || static_cast<size_t>(sparse.values.bufferView) >= model.bufferViews.size())
+	{
+		return false;
+	}
+
+	const tinygltf::BufferView& indexView = model.bufferViews[sparse.indices.bufferView];
+	const tinygltf::BufferView& valueView = model.bufferViews[sparse.values.bufferView];
+	size_t count = static_cast<size_t>(sparse.count);
+	if (sparse.indices.byteOffset + count * indexSize > indexView.byteLength ||
+		sparse.values.byteOffset + count * elementSize > valueView.byteLength)
+	{
+		return false;
+	}
+
+	const unsigned char* indices = spans[indexView.buffer].data + indexView.byteOffset + sparse.indices.byteOffset;
+	targets.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!ReadComponentIndex(indices + i * indexSize, sparse.indices.componentType, targets[i]) ||
+			targets[i] >= accessor.count)
+		{
+			return false;
+		}
+	}
+	values.data = spans[valueView.buffer].data + valueView.byteOffset + sparse.values.byteOffset;
+	values.size = count * elementSize;
+	return true;
+}
+
+// Decodes "components" floats per element of "accessor" into "out". Interleaved bufferViews are
+// followed through their byteStride, sparse accessors are applied on top of their base (or zeros).
+bool ReadAccessorFloats(const tinygltf::Model& model, const std::vector<BufferSpan>& spans,
+	const tinygltf::Accessor& accessor, uint32_t components, float* out, ScratchArena& scratch)
+{
+	uint32_t stride;
+	BufferSpan span = GetAccessorSpan(model, spans, accessor, stride);
+	int componentSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType));
+	int sourceComponents = tinygltf::GetNumComponentsInType(static_cast<uint32_t>(accessor.type));
+	if (componentSize <= 0 || sourceComponents < static_cast<int>(components))
+		return false;
+
+	auto readElement = [&](const unsigned char* element, float* destination)
+	{
+		for (uint32_t c = 0; c < components; ++c)
+		{
+			if (!ReadComponentFloat(element + c * componentSize, accessor.componentType, accessor.normalized, destination[c]))
+				return false;
+		}
+		return true;
+	};
+
+	if (accessor.bufferView < 0) // only allowed for sparse accessors, whose base is all zeros
+		std::fill(out, out + size_t(components) * accessor.count, 0.0f);
+	else if (span.data == nullptr || span.size < size_t(stride) * (accessor.count - 1) + size_t(componentSize) * components)
+		return false;
+	else
+	{
+		for (size_t i = 0; i < accessor.count; ++i)
+		{
+			if (!readElement(span.data + i * stride, out + i * components))
+				return false;
+		}
+	}
+
+	if (!accessor.sparse.isSparse)
+		return accessor.bufferView >= 0;
+	ScratchVector<uint32_t> targets(scratch);
+	BufferSpan values;
+	size_t elementSize = size_t(componentSize) * sourceComponents;
+	if (!GetSparseAccessor(model, spans, accessor, elementSize, targets, values))
+		return false;
+	for (size_t i = 0; i < targets.size(); ++i)
+	{
+		if (!readElement(values.data + i * elementSize, out + size_t(targets[i]) * components))
+			return false;
+	}
+	return true;
+}
+
+// Decodes any glTF index accessor (sparse ones included) into "out" using "outStride" (2 or 4) bytes per index
+bool ReadAccessorIndices(const tinygltf::Model& model, const std::vector<BufferSpan>& spans,
+	const tinygltf::Accessor& accessor, uint32_t outStride, unsigned char* out, ScratchArena& scratch)
+{
+	uint32_t stride;
+	BufferSpan span = GetAccessorSpan(model, spans, accessor, stride);
+	int componentSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType));
+	if (componentSize <= 0 || (accessor.bufferView < 0 && !accessor.sparse.isSparse) ||
+		(accessor.bufferView >= 0 && (span.data == nullptr || span.size < size_t(stride) * accessor.count)))
+	{
+		return false;
+	}
+
+	auto writeIndex = [&](size_t i, uint32_t index)
+	{
+		if (outStride == sizeof(uint16_t))
+		{
+			uint16_t narrow = static_cast<uint16_t>(index);
+			memcpy(out + i * outStride, &narrow, sizeof(narrow));
+		}
+		else
+			memcpy(out + i * outStride, &index, sizeof(index));
+	};
+
+	for (size_t i = 0; i < accessor.count; ++i)
+	{
+		uint32_t index = 0;
+		if (accessor.bufferView >= 0 && !ReadComponentIndex(span.data + i * stride, accessor.componentType, index))
+			return false;
+		writeIndex(i, index);
+	}
+
+	if (!accessor.sparse.isSparse)
+		return true;
+	ScratchVector<uint32_t> targets(scratch);
+	BufferSpan values;
+	if (!GetSparseAccessor(model, spans, accessor, componentSize, targets, values))
+		return false;
+	for (size_t i = 0; i < targets.size(); ++i)
+	{
+		uint32_t index;
+		if (!ReadComponentIndex(values.data + i * componentSize, accessor.componentType, index))
+			return false;
+		writeIndex(targets[i], index);
+	}
+	return true;
+}
+
+// result = a * b, all column major
+void MultiplyTransforms(const GeometryTransform& a, const GeometryTransform& b, GeometryTransform& result)
+{
+	GeometryTransform product;
+	for (int column = 0; column < 4; ++column)
+	{
+		for (int row = 0; row < 4; ++row)
+		{
+			float sum = 0;
+			for (int k = 0; k < 4; ++k)
+				sum += a.matrix[k * 4 + row] * b.matrix[column * 4 + k];
+			product.matrix[column * 4 + row] = sum;
+		}
+	}
+	result = product;
+}
+
+// A node's local matrix, either given directly or composed as T * R * S
+GeometryTransform GetNodeTransform(const tinygltf::Node& node)
+{
+	GeometryTransform transform = GEOMETRY_IDENTITY;
+	if (node.matrix.size() == 16)
+	{
+		for (int i = 0; i < 16; ++i)
+			transform.matrix[i] = static_cast<float>(node.matrix[i]);
+		return transform;
+	}
+
+	double s[3] = { 1, 1, 1 };
+	double q[4] = { 0, 0, 0, 1 };
+	for (size_t i = 0; i < 3 && node.scale.size() == 3; ++i)
+		s[i] = node.scale[i];
+	for (size_t i = 0; i < 4 && node.rotation.size() == 4; ++i)
+		q[i] = node.rotation[i];
+
+	double x = q[0], y = q[1], z = q[2], w = q[3];
+	double rotation[9] = // column major
+	{
+		1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+		2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+		2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)
+	};
+	for (int column = 0; column < 3; ++column)
+	{
+		for (int row = 0; row < 3; ++row)
+			transform.matrix[column * 4 + row] = static_cast<float>(rotation[column * 3 + row] * s[column]);
+	}
+	for (int i = 0; i < 3 && node.translation.size() == 3; ++i)
+		transform.matrix[12 + i] = static_cast<float>(node.translation[i]);
+	return transform;
+}
+
+// glTF image sampled by texture "texture", -1 when there is none
+int GetTextureImage(const tinygltf::Model& model, int texture)
+{
+	if (texture < 0 || texture >= static_cast<int>(model.textures.size()))
+		return -1;
+	int image = model.textures[texture].source;
+	return image < static_cast<int>(model.images.size()) ? image : -1;
+}
+
+void BuildGeometryMaterials(const tinygltf::Model& model, std::vector<GeometryMaterial>& materials)
+{
+	materials.resize(model.materials.size());
+	for (size_t i = 0; i < model.materials.size(); ++i)
+	{
+		const tinygltf::Material& source = model.materials[i];
+		GeometryMaterial& material = materials[i];
+		for (int c = 0; c < 4; ++c)
+			material.baseColorFactor[c] = static_cast<float>(source.pbrMetallicRoughness.baseColorFactor[c]);
+		for (int c = 0; c < 3; ++c)
+			material.emissiveFactor[c] = static_cast<float>(source.emissiveFactor[c]);
+		material.metallicFactor = static_cast<float>(source.pbrMetallicRoughness.metallicFactor);
+		material.roughnessFactor = static_cast<float>(source.pbrMetallicRoughness.roughnessFactor);
+		material.alphaCutoff = static_cast<float>(source.alphaCutoff);
+		material.baseColorTexture = source.pbrMetallicRoughness.baseColorTexture.index;
+		material.metallicRoughnessTexture = source.pbrMetallicRoughness.metallicRoughnessTexture.index;
+		material.normalTexture = source.normalTexture.index;
+		material.doubleSided = source.doubleSided ? 1u : 0u;
+		material.baseColorImage = GetTextureImage(model, material.baseColorTexture);
+		material.metallicRoughnessImage = GetTextureImage(model, material.metallicRoughnessTexture);
+	}
+}
+
+// Where one mesh primitive lives inside the pool, shared by every node instancing the mesh
+struct GeometryPrimitive
+{
+	int mesh;
+	int primitive;
+	GeometryDraw draw; // until PackGeometryIndices its indices are 32-bit scratch at draw.firstIndex
+	GeometryBounds bounds;
+	uint32_t sourceIndexSize; // width of the glTF indices, for INDEX_PACKING_SOURCE
+	uint32_t firstDraw; // draws the primitive was packed into, one unless it was split
+	uint32_t drawCount;
+};
+
+// Triangle list primitives with positions are the only ones the pipeline can draw
+bool IsDrawablePrimitive(const tinygltf::Primitive& primitive)
+{
+	return (primitive.mode == -1 || primitive.mode == TINYGLTF_MODE_TRIANGLES) &&
+		primitive.attributes.count("POSITION") != 0;
+}
+
+// Assigns every drawable primitive of every mesh its range of the pool and sizes the pool.
+// Indices are decoded as 32-bit scratch, PackGeometryIndices narrows them afterwards.
+void LayoutGeometryPrimitives(const tinygltf::Model& model, SceneGeometry& geometry,
+	std::vector<GeometryPrimitive>& primitives, std::vector<size_t>& meshFirstPrimitive)
+{
+	primitives.clear();
+	meshFirstPrimitive.assign(model.meshes.size() + 1, 0);
+	geometry.vertexCount = 0;
+	geometry.indexCount = 0;
+	geometry.narrowIndexCount = 0;
+	geometry.vertexFormat = GEOMETRY_VERTEX_FORMAT_FLOAT;
+
+	for (size_t m = 0; m < model.meshes.size(); ++m)
+	{
+		meshFirstPrimitive[m] = primitives.size();
+		for (size_t p = 0; p < model.meshes[m].primitives.size(); ++p)
+		{
+			const tinygltf::Primitive& source = model.meshes[m].primitives[p];
+			if (!IsDrawablePrimitive(source))
+			{
+				std::cout << "Skipping primitive " << p << " of mesh " << m << " (not a triangle list with positions)" << std::endl;
+				continue;
+			}
+			GeometryPrimitive primitive = {};
+			primitive.mesh = static_cast<int>(m);
+			primitive.primitive = static_cast<int>(p);
+			primitive.draw.vertexCount = static_cast<uint32_t>(model.accessors[source.attributes.at("POSITION")].count);
+			primitive.draw.indexCount = source.indices >= 0 ?
+				static_cast<uint32_t>(model.accessors[source.indices].count) : primitive.draw.vertexCount;
+			primitive.draw.firstIndex = geometry.indexCount;
+			primitive.draw.vertexOffset = static_cast<int32_t>(geometry.vertexCount);
+			primitive.draw.material = source.material;
+			primitive.draw.indexSize = sizeof(uint32_t);
+			if (source.indices >= 0)
+			{
+				primitive.sourceIndexSize = model.accessors[source.indices].componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT ?
+					sizeof(uint32_t) : sizeof(uint16_t);
+			}
+			else
+				primitive.sourceIndexSize = primitive.draw.vertexCount > MAX_NARROW_INDEX_VERTICES ? sizeof(uint32_t) : sizeof(uint16_t);
+			geometry.vertexCount += primitive.draw.vertexCount;
+			geometry.indexCount += primitive.draw.indexCount;
+			primitives.push_back(primitive);
+		}
+	}
+	meshFirstPrimitive[model.meshes.size()] = primitives.size();
+
+	// attributes no primitive provides take no space, they are drawn with GEOMETRY_STREAM_DEFAULTS
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		bool present = std::any_of(primitives.begin(), primitives.end(), [&](const GeometryPrimitive& primitive)
+		{
+			return model.meshes[primitive.mesh].primitives[primitive.primitive].attributes.count(GEOMETRY_STREAM_SEMANTICS[i]) != 0;
+		});
+		geometry.vertexStrides[i] = present ? GEOMETRY_STREAM_COMPONENTS[i] * sizeof(float) : 0;
+		geometry.streamStorage[i].assign(size_t(geometry.vertexStrides[i]) * geometry.vertexCount, 0);
+	}
+	geometry.indexStorage.assign(sizeof(uint32_t) * size_t(geometry.indexCount), 0);
+}
+
+// Decodes one primitive into its range of the pool, filling in defaults for missing attributes
+bool DecodeGeometryPrimitive(const tinygltf::Model& model, const std::vector<BufferSpan>& spans,
+	SceneGeometry& geometry, GeometryPrimitive& primitive, ScratchArena& scratch, std::string& err)
+{
+	const tinygltf::Primitive& source = model.meshes[primitive.mesh].primitives[primitive.primitive];
+	const GeometryDraw& draw = primitive.draw;
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		if (geometry.vertexStrides[i] == 0)
+			continue;
+		float* out = reinterpret_cast<float*>(geometry.streamStorage[i].data() + size_t(geometry.vertexStrides[i]) * draw.vertexOffset);
+		auto attribute = source.attributes.find(GEOMETRY_STREAM_SEMANTICS[i]);
+		if (attribute == source.attributes.end())
+		{
+			for (uint32_t v = 0; v < draw.vertexCount; ++v)
+				memcpy(out + v * GEOMETRY_STREAM_COMPONENTS[i], GEOMETRY_STREAM_DEFAULTS[i], geometry.vertexStrides[i]);
+			continue;
+		}
+		const tinygltf::Accessor& accessor = model.accessors[attribute->second];
+		if (accessor.count != draw.vertexCount || !ReadAccessorFloats(model, spans, accessor, GEOMETRY_STREAM_COMPONENTS[i], out, scratch))
+		{
+			err = "Mesh " + std::to_string(primitive.mesh) + " primitive " + std::to_string(primitive.primitive) +
+				" has an unreadable " + GEOMETRY_STREAM_SEMANTICS[i] + " accessor";
+			return false;
+		}
+	}
+
+	unsigned char* indices = geometry.indexStorage.data() + sizeof(uint32_t) * draw.firstIndex;
+	if (source.indices < 0)
+	{
+		for (uint32_t i = 0; i < draw.indexCount; ++i)
+			memcpy(indices + size_t(i) * sizeof(uint32_t), &i, sizeof(uint32_t));
+	}
+	else if (!ReadAccessorIndices(model, spans, model.accessors[source.indices], sizeof(uint32_t), indices, scratch))
+	{
+		err = "Mesh " + std::to_string(primitive.mesh) + " primitive " + std::to_string(primitive.primitive) +
+			" has an unreadable index accessor";
+		return false;
+	}
+	for (uint32_t i = 0; i < draw.indexCount; ++i)
+	{
+		uint32_t index;
+		memcpy(&index, indices + size_t(i) * sizeof(uint32_t), sizeof(index));
+		if (index >= draw.vertexCount)
+		{
+			err = "Mesh " + std::to_string(primitive.mesh) + " primitive " + std::to_string(primitive.primitive) +
+				" has indices past its vertices";
+			return false;
+		}
+	}
+
+	const float* positions = reinterpret_cast<const float*>(geometry.streamStorage[GEOMETRY_STREAM_POSITION].data()) +
+		size_t(3) * draw.vertexOffset;
+	GeometryBounds& bounds = primitive.bounds;
+	for (int c = 0; c < 3; ++c)
+	{
+		bounds.min[c] = draw.vertexCount ? FLT_MAX : 0.0f;
+		bounds.max[c] = draw.vertexCount ? -FLT_MAX : 0.0f;
+	}
+	for (uint32_t v = 0; v < draw.vertexCount; ++v)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			bounds.min[c] = std::min(bounds.min[c], positions[v * 3 + c]);
+			bounds.max[c] = std::max(bounds.max[c], positions[v * 3 + c]);
+		}
+	}
+	return true;
+}
+
+// Reorders a decoded primitive's triangles and vertices in place (see MeshOptimizer.h).
+// Only its own range of the pool is touched, so this is safe to run alongside other primitives.
+void OptimizeGeometryPrimitive(SceneGeometry& geometry, const GeometryPrimitive& primitive, ScratchArena& scratch)
+{
+	const GeometryDraw& draw = primitive.draw;
+	uint32_t* indices = reinterpret_cast<uint32_t*>(geometry.indexStorage.data()) + draw.firstIndex;
+
+	// the decode already rejected out of range indices, only whole triangle lists are reordered
+	if (draw.indexCount % 3 != 0)
+		return;
+
+	const float* positions = reinterpret_cast<const float*>(geometry.streamStorage[GEOMETRY_STREAM_POSITION].data()) +
+		size_t(3) * draw.vertexOffset;
+	ScratchVector<uint32_t> ordered(draw.indexCount, 0, scratch);
+	OptimizeVertexCache(ordered.data(), indices, draw.indexCount, draw.vertexCount, scratch);
+	OptimizeOverdraw(indices, ordered.data(), ordered.size(), positions, draw.vertexCount, scratch);
+
+	ScratchVector<uint32_t> remap(draw.vertexCount, 0, scratch);
+	RemapVertexFetch(indices, draw.indexCount, draw.vertexCount, remap.data());
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		if (geometry.vertexStrides[i] != 0)
+		{
+			ApplyVertexRemap(geometry.streamStorage[i].data() + size_t(geometry.vertexStrides[i]) * draw.vertexOffset,
+				geometry.vertexStrides[i], draw.vertexCount, remap.data(), scratch);
+		}
+	}
+}
+
+// Per primitive output of the parallel decode, read back in primitive order once it converges
+struct GeometryDecodeResult
+{
+	bool decoded;
+	GeometryBounds bounds;
+	std::string err;
+};
+
+struct GeometryDecodeContext
+{
+	const tinygltf::Model* model;
+	const std::vector<BufferSpan>* spans;
+	SceneGeometry* geometry;
+	ScratchArena* arenas; // one per section, a section's primitives run one after another
+	unsigned int section;
+};
+
+// BranchParallel task, primitives only ever write to their own slices of the pool
+void DecodeGeometryPrimitiveTask(const GeometryPrimitive* primitive, GeometryDecodeResult* result,
+	unsigned int index, const void* userData)
+{
+	const GeometryDecodeContext* context = static_cast<const GeometryDecodeContext*>(userData);
+	ScratchArena& scratch = context->arenas[index / context->section];
+	ScratchArena::Marker mark = scratch.Mark();
+	GeometryPrimitive decoded = *primitive;
+	result->decoded = DecodeGeometryPrimitive(*context->model, *context->spans, *context->geometry, decoded, scratch, result->err);
+	result->bounds = decoded.bounds;
+	if (result->decoded)
+		OptimizeGeometryPrimitive(*context->geometry, decoded, scratch);
+	scratch.Rewind(mark); // the next primitive of the section reuses the same memory
+}
+
+// Fans DecodeGeometryPrimitive out across the Gateware thread pool. The pool layout was fixed up
+// front by LayoutGeometryPrimitives, so the result is identical to decoding serially.
+// Waits for the pool, so it must not be called from inside a pool job.
+bool DecodeGeometryPrimitives(const tinygltf::Model& model, const std::vector<BufferSpan>& spans,
+	SceneGeometry& geometry, std::vector<GeometryPrimitive>& primitives, std::string& err)
+{
+	std::vector<GeometryDecodeResult> results(primitives.size());
+
+	// a few sections per core keeps the threads busy when primitive sizes are uneven
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int count = static_cast<unsigned int>(primitives.size());
+	unsigned int section = std::max(1u, count / (threads * 4));
+	unsigned int sectionCount = (count + section - 1) / section;
+	std::unique_ptr<ScratchArena[]> arenas(new ScratchArena[sectionCount]);
+	GeometryDecodeContext context = { &model, &spans, &geometry, arenas.get(), section };
+
+	GW::SYSTEM::GConcurrent concurrent;
+	if (count == 1 || -concurrent.Create(true) ||
+		-concurrent.BranchParallel(DecodeGeometryPrimitiveTask, section, count, &context,
+			0, primitives.data(), 0, results.data()))
+	{
+		for (unsigned int i = 0; i < count; ++i) // too small to go wide, or the pool is unavailable
+			DecodeGeometryPrimitiveTask(&primitives[i], &results[i], i, &context);
+	}
+	else
+		concurrent.Converge(0);
+
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		if (!results[i].decoded)
+		{
+			err = results[i].err;
+			return false;
+		}
+		primitives[i].bounds = results[i].bounds;
+	}
+	return true;
+}
+
+// Moves the 32-bit scratch indices into their final sections and fills "packedDraws".
+// Splitting gives every sub-mesh its own copy of the vertices it uses, so the vertex streams are
+// rebuilt (in first use order) only when some primitive actually gets split.
+void PackGeometryIndices(SceneGeometry& geometry, std::vector<GeometryPrimitive>& primitives, INDEX_PACKING packing,
+	std::vector<GeometryDraw>& packedDraws, ScratchArena& scratch)
+{
+	bool rebuildStreams = false;
+	size_t wideCount = 0;
+	for (const GeometryPrimitive& primitive : primitives)
+	{
+		bool fitsNarrow = primitive.draw.vertexCount <= MAX_NARROW_INDEX_VERTICES;
+		if (packing == INDEX_PACKING_SPLIT && !fitsNarrow)
+			rebuildStreams = true;
+		else if (!fitsNarrow || (packing == INDEX_PACKING_SOURCE && primitive.sourceIndexSize == sizeof(uint32_t)))
+			wideCount += primitive.draw.indexCount;
+	}
+
+	// sized up front, a growing vector would leave every outgrown copy behind in the arena
+	ScratchVector<uint16_t> narrow(scratch);
+	ScratchVector<uint32_t> wide(scratch);
+	narrow.reserve(geometry.indexCount - wideCount);
+	wide.reserve(wideCount);
+	std::vector<unsigned char> streams[GEOMETRY_STREAM_COUNT];
+	uint32_t vertexCount = 0;
+	ScratchVector<int32_t> localIndex(scratch); // split only: pool vertex -> sub-mesh vertex, -1 when unused
+	ScratchVector<uint32_t> subMeshVertices(scratch);
+	packedDraws.clear();
+
+	// appends pool vertices to the rebuilt streams, returning their new offset
+	auto appendVertices = [&](const uint32_t* source, uint32_t count)
+	{
+		for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+		{
+			uint32_t stride = geometry.vertexStrides[i];
+			if (stride == 0)
+				continue;
+			size_t start = streams[i].size();
+			streams[i].resize(start + size_t(stride) * count);
+			for (uint32_t v = 0; v < count; ++v)
+				memcpy(streams[i].data() + start + size_t(v) * stride, geometry.streamStorage[i].data() + size_t(source[v]) * stride, stride);
+		}
+		vertexCount += count;
+		return static_cast<int32_t>(vertexCount - count);
+	};
+
+	for (GeometryPrimitive& primitive : primitives)
+	{
+		const GeometryDraw& source = primitive.draw;
+		const uint32_t* indices = reinterpret_cast<const uint32_t*>(geometry.indexStorage.data()) + source.firstIndex;
+		primitive.firstDraw = static_cast<uint32_t>(packedDraws.size());
+
+		bool fitsNarrow = source.vertexCount <= MAX_NARROW_INDEX_VERTICES;
+		if (packing == INDEX_PACKING_SPLIT && !fitsNarrow)
+		{
+			// greedy in index order, which keeps the vertex cache order of each sub-mesh intact
+			localIndex.assign(source.vertexCount, -1);
+			size_t triangle = 0;
+			while (triangle * 3 + 2 < source.indexCount)
+			{
+				GeometryDraw draw = source;
+				draw.indexSize = sizeof(uint16_t);
+				draw.firstIndex = static_cast<uint32_t>(narrow.size());
+				subMeshVertices.clear();
+				for (; triangle * 3 + 2 < source.indexCount; ++triangle)
+				{
+					const uint32_t* corners = &indices[triangle * 3];
+					uint32_t added = 0;
+					for (int k = 0; k < 3; ++k)
+					{
+						bool repeated = (k > 0 && corners[k] == corners[0]) || (k > 1 && corners[k] == corners[1]);
+						added += localIndex[corners[k]] < 0 && !repeated ? 1 : 0;
+					}
+					if (subMeshVertices.size() + added > MAX_NARROW_INDEX_VERTICES)
+						break;
+					for (int k = 0; k < 3; ++k)
+					{
+						if (localIndex[corners[k]] < 0)
+						{
+							localIndex[corners[k]] = static_cast<int32_t>(subMeshVertices.size());
+							subMeshVertices.push_back(corners[k]);
+						}
+						narrow.push_back(static_cast<uint16_t>(localIndex[corners[k]]));
+					}
+				}
+				for (uint32_t v : subMeshVertices)
+					localIndex[v] = -1;
+
+				for (uint32_t& v : subMeshVertices)
+					v += static_cast<uint32_t>(source.vertexOffset);
+				draw.vertexOffset = appendVertices(subMeshVertices.data(), static_cast<uint32_t>(subMeshVertices.size()));
+				draw.vertexCount = static_cast<uint32_t>(subMeshVertices.size());
+				draw.indexCount = static_cast<uint32_t>(narrow.size()) - draw.firstIndex;
+				packedDraws.push_back(draw);
+			}
+			primitive.drawCount = static_cast<uint32_t>(packedDraws.size()) - primitive.firstDraw;
+			continue;
+		}
+
+		GeometryDraw draw = source;
+		if (rebuildStreams)
+		{
+			ScratchVector<uint32_t> range(source.vertexCount, 0, scratch);
+			for (uint32_t v = 0; v < source.vertexCount; ++v)
+				range[v] = static_cast<uint32_t>(source.vertexOffset) + v;
+			draw.vertexOffset = appendVertices(range.data(), source.vertexCount);
+		}
+		if (fitsNarrow && (packing != INDEX_PACKING_SOURCE || primitive.sourceIndexSize == sizeof(uint16_t)))
+		{
+			draw.indexSize = sizeof(uint16_t);
+			draw.firstIndex = static_cast<uint32_t>(narrow.size());
+			for (uint32_t i = 0; i < source.indexCount; ++i)
+				narrow.push_back(static_cast<uint16_t>(indices[i]));
+		}
+		else
+		{
+			draw.indexSize = sizeof(uint32_t);
+			draw.firstIndex = static_cast<uint32_t>(wide.size());
+			wide.insert(wide.end(), indices, indices + source.indexCount);
+		}
+		packedDraws.push_back(draw);
+		primitive.drawCount = 1;
+	}
+
+	if (rebuildStreams)
+	{
+		for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+			geometry.streamStorage[i].swap(streams[i]);
+		geometry.vertexCount = vertexCount;
+	}
+	geometry.narrowIndexCount = static_cast<uint32_t>(narrow.size());
+	geometry.indexCount = static_cast<uint32_t>(narrow.size() + wide.size());
+	geometry.indexStorage.assign(GetWideIndexOffset(geometry) + wide.size() * sizeof(uint32_t), 0);
+	memcpy(geometry.indexStorage.data(), narrow.data(), narrow.size() * sizeof(uint16_t));
+	memcpy(geometry.indexStorage.data() + GetWideIndexOffset(geometry), wide.data(), wide.size() * sizeof(uint32_t));
+}
+
+// Walks the default scene and emits one draw (with its world matrix) per instanced primitive
+void BuildSceneDraws(const tinygltf::Model& model, const std::vector<GeometryPrimitive>& primitives,
+	const std::vector<GeometryDraw>& packedDraws, const std::vector<size_t>& meshFirstPrimitive, SceneGeometry& geometry)
+{
+	geometry.draws.clear();
+	geometry.bounds.clear();
+	geometry.transforms.clear();
+	auto emitMesh = [&](int mesh, const GeometryTransform& world)
+	{
+		for (size_t p = meshFirstPrimitive[mesh]; p < meshFirstPrimitive[mesh + 1]; ++p)
+		{
+			for (uint32_t d = primitives[p].firstDraw; d < primitives[p].firstDraw + primitives[p].drawCount; ++d)
+			{
+				geometry.draws.push_back(packedDraws[d]);
+				geometry.bounds.push_back(primitives[p].bounds); // sub-meshes keep the whole primitive's bounds
+				geometry.transforms.push_back(world);
+			}
+		}
+	};
+
+	// a file without scenes is still allowed to hold meshes, draw each of them once
+	if (model.scenes.empty())
+	{
+		for (size_t m = 0; m < model.meshes.size(); ++m)
+			emitMesh(static_cast<int>(m), GEOMETRY_IDENTITY);
+		return;
+	}
+
+	const tinygltf::Scene& scene = model.scenes[model.defaultScene >= 0 ? model.defaultScene : 0];
+	std::vector<std::pair<int, GeometryTransform>> stack;
+	for (int root : scene.nodes)
+		stack.push_back(std::make_pair(root, GEOMETRY_IDENTITY));
+	std::reverse(stack.begin(), stack.end()); // keep draws in scene order
+
+	// glTF node hierarchies are acyclic, the visit limit only guards against broken files
+	size_t visits = 0;
+	while (!stack.empty() && visits++ <= model.nodes.size() * 4)
+	{
+		int nodeIndex = stack.back().first;
+		GeometryTransform parent = stack.back().second;
+		stack.pop_back();
+		if (nodeIndex < 0 || static_cast<size_t>(nodeIndex) >= model.nodes.size())
+			continue;
+
+		const tinygltf::Node& node = model.nodes[nodeIndex];
+		GeometryTransform world;
+		MultiplyTransforms(parent, GetNodeTransform(node), world);
+		if (node.mesh >= 0 && static_cast<size_t>(node.mesh) < model.meshes.size())
+			emitMesh(node.mesh, world);
+		for (auto child = node.children.rbegin(); child != node.children.rend(); ++child)
+			stack.push_back(std::make_pair(*child, world));
+	}
+}
+
+// Packs every primitive of every mesh into one pool and builds a draw for each node that uses it
+bool BuildSceneGeometry(const tinygltf::Model& model, const std::vector<BufferSpan>& spans,
+	SceneGeometry& geometry, std::string& err, INDEX_PACKING packing = INDEX_PACKING_REPACK)
+{
+	std::vector<GeometryPrimitive> primitives;
+	std::vector<size_t> meshFirstPrimitive;
+	LayoutGeometryPrimitives(model, geometry, primitives, meshFirstPrimitive);
+	if (primitives.empty())
+	{
+		err = "Model contains no drawable mesh primitives";
+		return false;
+	}
+
+	// temporaries of the decode & pack live in arenas, freed in one go when the load is done
+	ScratchArena scratch;
+	if (!DecodeGeometryPrimitives(model, spans, geometry, primitives, err))
+		return false;
+	std::vector<GeometryDraw> packedDraws;
+	PackGeometryIndices(geometry, primitives, packing, packedDraws, scratch);
+
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		geometry.vertexStreams[i].data = geometry.streamStorage[i].data();
+		geometry.vertexStreams[i].size = geometry.streamStorage[i].size();
+	}
+	geometry.indices.data = geometry.indexStorage.data();
+	geometry.indices.size = geometry.indexStorage.size();
+
+	BuildSceneDraws(model, primitives, packedDraws, meshFirstPrimitive, geometry);
+	BuildGeometryMaterials(model, geometry.materials);
+	return true;
+}
+
+
+// Half open range of vertices or indices in the pool
+struct GeometryRange
+{
+	uint32_t first;
+	uint32_t end;
+};
+
+// True when both pack into exactly the same places: same counts, streams, format & draw ranges.
+// Only the pool's contents (and the transforms & materials) may differ between them.
+bool IsSameGeometryShape(const SceneGeometry& before, const SceneGeometry& after)
+{
+	if (before.vertexCount != after.vertexCount || before.indexCount != after.indexCount ||
+		before.narrowIndexCount != after.narrowIndexCount || before.vertexFormat != after.vertexFormat ||
+		before.draws.size() != after.draws.size() || before.indices.size != after.indices.size ||
+		before.indices.data == nullptr || after.indices.data == nullptr)
+		return false;
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		if (before.vertexStrides[i] != after.vertexStrides[i] || before.vertexStreams[i].size != after.vertexStreams[i].size)
+			return false;
+	}
+	for (size_t i = 0; i < before.draws.size(); ++i)
+	{
+		const GeometryDraw& a = before.draws[i];
+		const GeometryDraw& b = after.draws[i];
+		if (a.firstIndex != b.firstIndex || a.indexCount != b.indexCount || a.vertexOffset != b.vertexOffset ||
+			a.vertexCount != b.vertexCount || a.indexSize != b.indexSize)
+			return false;
+	}
+	return true;
+}
+
+// Sorts "ranges" and joins the ones that overlap or touch
+void MergeGeometryRanges(std::vector<GeometryRange>& ranges)
+{
+	std::sort(ranges.begin(), ranges.end(), [](const GeometryRange& a, const GeometryRange& b) { return a.first < b.first; });
+	size_t merged = 0;
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		if (merged > 0 && ranges[i].first <= ranges[merged - 1].end)
+			ranges[merged - 1].end = std::max(ranges[merged - 1].end, ranges[i].end);
+		else
+			ranges[merged++] = ranges[i];
+	}
+	ranges.resize(merged);
+}
+
+// The vertex & index ranges of every draw whose primitive differs between two geometries of the
+// same shape (see IsSameGeometryShape), merged so none of them overlap
+void CollectChangedGeometryRanges(const SceneGeometry& before, const SceneGeometry& after,
+	std::vector<GeometryRange>& vertices, std::vector<GeometryRange>& narrowIndices, std::vector<GeometryRange>& wideIndices)
+{
+	vertices.clear();
+	narrowIndices.clear();
+	wideIndices.clear();
+	for (const GeometryDraw& draw : after.draws)
+	{
+		bool changed = false;
+		for (int i = 0; i < GEOMETRY_STREAM_COUNT && !changed; ++i)
+		{
+			size_t offset = size_t(draw.vertexOffset) * after.vertexStrides[i];
+			changed = memcmp(before.vertexStreams[i].data + offset, after.vertexStreams[i].data + offset,
+				size_t(draw.vertexCount) * after.vertexStrides[i]) != 0;
+		}
+		size_t indexOffset = (draw.indexSize == sizeof(uint32_t) ? GetWideIndexOffset(after) : 0) +
+			size_t(draw.firstIndex) * draw.indexSize;
+		if (!changed && memcmp(before.indices.data + indexOffset, after.indices.data + indexOffset,
+			size_t(draw.indexCount) * draw.indexSize) == 0)
+			continue;
+
+		GeometryRange vertexRange = { static_cast<uint32_t>(draw.vertexOffset), draw.vertexOffset + draw.vertexCount };
+		GeometryRange indexRange = { draw.firstIndex, draw.firstIndex + draw.indexCount };
+		vertices.push_back(vertexRange);
+		(draw.indexSize == sizeof(uint32_t) ? wideIndices : narrowIndices).push_back(indexRange);
+	}
+	MergeGeometryRanges(vertices);
+	MergeGeometryRanges(narrowIndices);
+	MergeGeometryRanges(wideIndices);
+}
+
+// A cube of positions & normals drawn while a model streams in, faces wind counter-clockwise like glTF
+void BuildPlaceholderGeometry(SceneGeometry& geometry, float halfExtent)
+{
+	// per face: normal axis & sign, then the two in-plane axes whose cross product is the normal
+	const int faces[6][4] = { { 0, 1, 1, 2 }, { 0, -1, 2, 1 }, { 1, 1, 2, 0 }, { 1, -1, 0, 2 }, { 2, 1, 0, 1 }, { 2, -1, 1, 0 } };
+	const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+
+	geometry = SceneGeometry();
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<uint16_t> indices;
+	for (int face = 0; face < 6; ++face)
+	{
+		uint16_t first = static_cast<uint16_t>(positions.size() / 3);
+		for (int corner = 0; corner < 4; ++corner)
+		{
+			float position[3] = {};
+			float normal[3] = {};
+			normal[faces[face][0]] = static_cast<float>(faces[face][1]);
+			position[faces[face][0]] = faces[face][1] * halfExtent;
+			position[faces[face][2]] = corners[corner][0] * halfExtent;
+			position[faces[face][3]] = corners[corner][1] * halfExtent;
+			positions.insert(positions.end(), position, position + 3);
+			normals.insert(normals.end(), normal, normal + 3);
+		}
+		const uint16_t quad[6] = { 0, 1, 2, 0, 2, 3 };
+		for (uint16_t index : quad)
+			indices.push_back(first + index);
+	}
+
+	geometry.vertexCount = static_cast<uint32_t>(positions.size() / 3);
+	geometry.indexCount = geometry.narrowIndexCount = static_cast<uint32_t>(indices.size());
+	geometry.vertexStrides[GEOMETRY_STREAM_POSITION] = geometry.vertexStrides[GEOMETRY_STREAM_NORMAL] = 3 * sizeof(float);
+	geometry.streamStorage[GEOMETRY_STREAM_POSITION].assign(reinterpret_cast<const unsigned char*>(positions.data()),
+		reinterpret_cast<const unsigned char*>(positions.data() + positions.size()));
+	geometry.streamStorage[GEOMETRY_STREAM_NORMAL].assign(reinterpret_cast<const unsigned char*>(normals.data()),
+		reinterpret_cast<const unsigned char*>(normals.data() + normals.size()));
+	geometry.indexStorage.assign(GetWideIndexOffset(geometry), 0);
+	memcpy(geometry.indexStorage.data(), indices.data(), indices.size() * sizeof(uint16_t));
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		geometry.vertexStreams[i].data = geometry.streamStorage[i].data();
+		geometry.vertexStreams[i].size = geometry.streamStorage[i].size();
+	}
+	geometry.indices.data = geometry.indexStorage.data();
+	geometry.indices.size = geometry.indexStorage.size();
+
+	GeometryDraw draw = { 0, geometry.indexCount, 0, geometry.vertexCount, -1, sizeof(uint16_t), { 0, 0 } };
+	GeometryBounds bounds = { { -halfExtent, -halfExtent, -halfExtent }, { halfExtent, halfExtent, halfExtent } };
+	geometry.draws.push_back(draw);
+	geometry.bounds.push_back(bounds);
+	geometry.transforms.push_back(GEOMETRY_IDENTITY);
+}
+
+#endif
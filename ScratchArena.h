@@ -0,0 +1,122 @@
+// Monotonic memory for the temporaries of a model load. Allocating bumps a pointer inside large
+// blocks and freeing is a no-op: everything past a Mark() goes at once with Rewind(), and the
+// blocks themselves are released when the arena is destroyed. Not thread safe, use one per thread.
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+const size_t SCRATCH_ARENA_BLOCK_SIZE = 1 << 20; // requests larger than this get a block of their own
+
+// Summable across the arenas of one load
+struct ScratchArenaStats
+{
+	size_t allocations = 0;
+	size_t reserved = 0; // bytes held in blocks
+	size_t blocks = 0;
+
+	void operator+=(const ScratchArenaStats& other)
+	{
+		allocations += other.allocations;
+		reserved += other.reserved;
+		blocks += other.blocks;
+	}
+};
+
+class ScratchArena
+{
+	struct Block
+	{
+		unsigned char* data;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	size_t current = 0; // block allocations are bumped from
+	size_t used = 0; // bytes taken from blocks[current]
+	size_t blockSize;
+	ScratchArenaStats stats;
+
+public:
+	struct Marker
+	{
+		size_t block;
+		size_t used;
+	};
+
+	explicit ScratchArena(size_t _blockSize = SCRATCH_ARENA_BLOCK_SIZE) : blockSize(_blockSize) {}
+	~ScratchArena()
+	{
+		for (const Block& block : blocks)
+			std::free(block.data);
+	}
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	// "alignment" must be a power of two no larger than malloc's
+	void* Allocate(size_t size, size_t alignment)
+	{
+		++stats.allocations;
+		for (; current < blocks.size(); ++current, used = 0)
+		{
+			size_t offset = (used + alignment - 1) & ~(alignment - 1);
+			if (offset + size <= blocks[current].size)
+			{
+				used = offset + size;
+				return blocks[current].data + offset;
+			}
+		}
+
+		Block block;
+		block.size = std::max(blockSize, size);
+		block.data = static_cast<unsigned char*>(std::malloc(block.size));
+		if (block.data == nullptr)
+			throw std::bad_alloc();
+		blocks.push_back(block);
+		++stats.blocks;
+		stats.reserved += block.size;
+		current = blocks.size() - 1;
+		used = size;
+		return block.data;
+	}
+
+	Marker Mark() const { return Marker{ current, used }; }
+
+	// Everything allocated after "marker" is gone, its blocks are kept for the next allocations
+	void Rewind(const Marker& marker)
+	{
+		current = marker.block;
+		used = marker.used;
+	}
+
+	void Reset() { Rewind(Marker{ 0, 0 }); }
+
+	const ScratchArenaStats& Stats() const { return stats; }
+};
+
+// Lets standard containers allocate from an arena, deallocation is left to the arena
+template <typename T>
+struct ScratchAllocator
+{
+	typedef T value_type;
+	ScratchArena* arena;
+
+	ScratchAllocator(ScratchArena& _arena) : arena(&_arena) {}
+	template <typename U>
+	ScratchAllocator(const ScratchAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count) { return static_cast<T*>(arena->Allocate(count * sizeof(T), alignof(T))); }
+	void deallocate(T*, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const ScratchAllocator<T>& a, const ScratchAllocator<U>& b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ScratchAllocator<T>& a, const ScratchAllocator<U>& b) { return a.arena != b.arena; }
+
+template <typename T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
+
+#endif
@@ -0,0 +1,87 @@
+// Requires ContentHash.h, MappedFile.h & CacheFolder.h
+// On-disk cache of compiled SPIR-V. An entry is named after a hash of everything that affects
+// the compiler's output, so a changed source, entry point, stage or option set simply misses.
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <fstream>
+
+const char SHADER_CACHE_MAGIC[4] = { 'S', 'P', 'V', 'C' };
+const uint32_t SHADER_CACHE_VERSION = 1; // bump when the compiler or its setup changes
+const uint32_t SPIRV_MAGIC = 0x07230203;
+
+struct ShaderCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key; // repeated so a renamed file can't be mistaken for another shader
+	uint64_t spirvHash;
+	uint64_t spirvSize;
+};
+
+static_assert(sizeof(ShaderCacheHeader) == 32, "ShaderCacheHeader is part of the shader cache format");
+
+// "optionsKey" must change whenever the compile options do, see Renderer::GetCompileOptionsKey
+uint64_t GetShaderCacheKey(const char* source, size_t size, const char* entryPoint, int stage, const std::string& optionsKey)
+{
+	uint64_t hash = HashBytes(source, size);
+	hash = HashString(entryPoint, hash);
+	hash = HashBytes(&stage, sizeof(stage), hash);
+	hash = HashString(optionsKey, hash);
+	return HashBytes(&SHADER_CACHE_VERSION, sizeof(SHADER_CACHE_VERSION), hash);
+}
+
+std::string GetShaderCachePath(const std::string& cacheFolder, uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(key));
+	return cacheFolder + name;
+}
+
+// Fills "spirv" from a valid entry, false on a miss or a damaged file
+bool ReadShaderCache(const std::string& cachePath, uint64_t key, std::vector<uint32_t>& spirv)
+{
+	MappedFile file;
+	if (!file.Open(cachePath.c_str()) || file.Size() < sizeof(ShaderCacheHeader))
+		return false;
+
+	ShaderCacheHeader header;
+	memcpy(&header, file.Data(), sizeof(header));
+	const unsigned char* payload = file.Data() + sizeof(header);
+	if (memcmp(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != SHADER_CACHE_VERSION ||
+		header.key != key || header.spirvSize != file.Size() - sizeof(header) || header.spirvSize % 4 != 0 ||
+		header.spirvSize < 4 || HashBytes(payload, static_cast<size_t>(header.spirvSize)) != header.spirvHash)
+	{
+		return false;
+	}
+
+	spirv.resize(static_cast<size_t>(header.spirvSize / 4));
+	memcpy(spirv.data(), payload, static_cast<size_t>(header.spirvSize));
+	return spirv[0] == SPIRV_MAGIC;
+}
+
+bool WriteShaderCache(const std::string& cachePath, uint64_t key, const void* spirv, size_t size)
+{
+	ShaderCacheHeader header = {};
+	memcpy(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic));
+	header.version = SHADER_CACHE_VERSION;
+	header.key = key;
+	header.spirvHash = HashBytes(spirv, size);
+	header.spirvSize = size;
+
+	// written under a temporary name so a concurrent launch never maps half a file
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(static_cast<const char*>(spirv), static_cast<std::streamsize>(size));
+		if (!file)
+			return false;
+	}
+	std::remove(cachePath.c_str());
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,349 @@
+// Requires ContentHash.h, MappedFile.h, FileService.h, SceneGeometry.h, TextureLoader.h & TextureCompression.h
+// Cooked textures: every image a material samples is block compressed with its whole mip chain and
+// written as a KTX2 file next to the model, so the renderer uploads the levels as they are instead
+// of decoding and filtering. A file is only used while the hash of the encoded image it was cooked
+// from still matches, the hash is kept under a key of its own in the KTX2 key/value data.
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <fstream>
+
+enum TEXTURE_COMPRESSION
+{
+	TEXTURE_COMPRESSION_NONE = 0, // no textures are cooked, they are decoded at load
+	TEXTURE_COMPRESSION_BC7, // BC7 color, BC5 metallic-roughness
+	TEXTURE_COMPRESSION_BC1, // like BC7 but opaque color takes BC1, half the size at lower quality
+	TEXTURE_COMPRESSION_COUNT
+};
+
+const char* const TEXTURE_COMPRESSION_NAMES[TEXTURE_COMPRESSION_COUNT] = { "none", "bc7", "bc1" };
+
+bool ParseTextureCompression(const std::string& name, TEXTURE_COMPRESSION& compression)
+{
+	for (int i = 0; i < TEXTURE_COMPRESSION_COUNT; ++i)
+	{
+		if (name == TEXTURE_COMPRESSION_NAMES[i])
+		{
+			compression = static_cast<TEXTURE_COMPRESSION>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+const char TEXTURE_CACHE_HASH_KEY[] = "GWSourceHash"; // value: 64-bit HashBytes of the encoded source image
+const uint64_t TEXTURE_CACHE_ALIGNMENT = 16; // level data starts on a block (and texel copy) boundary
+
+struct Ktx2Header
+{
+	unsigned char identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+struct Ktx2Level
+{
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header is the KTX2 file header");
+static_assert(sizeof(Ktx2Level) == 24, "Ktx2Level is a KTX2 level index entry");
+
+const char* GetTextureFormatName(uint32_t format)
+{
+	switch (format)
+	{
+	case TEXTURE_FORMAT_BC1: return "BC1";
+	case TEXTURE_FORMAT_BC1_SRGB: return "BC1 sRGB";
+	case TEXTURE_FORMAT_BC5: return "BC5";
+	case TEXTURE_FORMAT_BC7: return "BC7";
+	case TEXTURE_FORMAT_BC7_SRGB: return "BC7 sRGB";
+	default: return "RGBA8";
+	}
+}
+
+// "../Models/Bebe.glb", 0 -> "../Models/Bebe.image0.ktx2"
+std::string GetTextureCachePath(const std::string& sourcePath, int image)
+{
+	size_t dot = sourcePath.find_last_of('.');
+	size_t slash = sourcePath.find_last_of("/\\");
+	std::string stem = dot == std::string::npos || (slash != std::string::npos && dot < slash) ?
+		sourcePath : sourcePath.substr(0, dot);
+	return stem + ".image" + std::to_string(image) + ".ktx2";
+}
+
+// Basic data format descriptor KTX2 requires, one sample per channel of the BC1, BC5 or BC7 block
+void BuildKtx2Descriptor(uint32_t format, std::vector<uint32_t>& dfd)
+{
+	bool bc1 = format == TEXTURE_FORMAT_BC1 || format == TEXTURE_FORMAT_BC1_SRGB;
+	uint32_t samples = format == TEXTURE_FORMAT_BC5 ? 2 : 1;
+	uint32_t blockSize = 24 + 16 * samples;
+	uint32_t sampleBits = GetTextureBlockBytes(format) * 8 / samples;
+	uint32_t colorModel = bc1 ? 128 : format == TEXTURE_FORMAT_BC5 ? 132 : 134; // KHR_DF_MODEL_BC1A, BC5, BC7
+	uint32_t transfer = IsSrgbFormat(format) ? 2 : 1; // KHR_DF_TRANSFER_SRGB or LINEAR
+
+	dfd.clear();
+	dfd.push_back(4 + blockSize); // total size
+	dfd.push_back(0); // Khronos vendor, basic descriptor
+	dfd.push_back(2 | (blockSize << 16)); // version 2
+	dfd.push_back(colorModel | (1 << 8) | (transfer << 16)); // BT.709 primaries, straight alpha
+	dfd.push_back(3 | (3 << 8)); // 4x4x1 texel block, stored as dimension - 1
+	dfd.push_back(GetTextureBlockBytes(format)); // bytes in plane 0
+	dfd.push_back(0);
+	for (uint32_t s = 0; s < samples; ++s)
+	{
+		dfd.push_back((s * sampleBits) | ((sampleBits - 1) << 16) | (s << 24)); // channel: color, or red & green for BC5
+		dfd.push_back(0); // sample position
+		dfd.push_back(0); // lower
+		dfd.push_back(0xFFFFFFFF); // upper
+	}
+}
+
+bool WriteTextureCache(const std::string& cachePath, const CompressedTexture& texture, uint64_t sourceHash)
+{
+	std::vector<uint32_t> dfd;
+	BuildKtx2Descriptor(texture.format, dfd);
+
+	// a single key/value entry: its length, the NUL terminated key and the value, padded to 4 bytes
+	uint32_t entryLength = sizeof(TEXTURE_CACHE_HASH_KEY) + sizeof(sourceHash);
+	std::vector<unsigned char> kvd((sizeof(entryLength) + entryLength + 3) & ~size_t(3));
+	memcpy(kvd.data(), &entryLength, sizeof(entryLength));
+	memcpy(kvd.data() + sizeof(entryLength), TEXTURE_CACHE_HASH_KEY, sizeof(TEXTURE_CACHE_HASH_KEY));
+	memcpy(kvd.data() + sizeof(entryLength) + sizeof(TEXTURE_CACHE_HASH_KEY), &sourceHash, sizeof(sourceHash));
+
+	uint32_t levelCount = static_cast<uint32_t>(texture.levelOffsets.size());
+	Ktx2Header header = {};
+	memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(header.identifier));
+	header.vkFormat = texture.format;
+	header.typeSize = 1;
+	header.pixelWidth = texture.width;
+	header.pixelHeight = texture.height;
+	header.faceCount = 1;
+	header.levelCount = levelCount;
+	uint64_t cursor = sizeof(header) + levelCount * sizeof(Ktx2Level);
+	header.dfdByteOffset = static_cast<uint32_t>(cursor);
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+	cursor += header.dfdByteLength;
+	header.kvdByteOffset = static_cast<uint32_t>(cursor);
+	header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+	cursor += kvd.size();
+
+	// KTX2 stores the smallest level first
+	std::vector<Ktx2Level> levels(levelCount);
+	for (uint32_t level = levelCount; level-- > 0;)
+	{
+		size_t end = level + 1 < levelCount ? texture.levelOffsets[level + 1] : texture.data.size();
+		cursor = (cursor + TEXTURE_CACHE_ALIGNMENT - 1) & ~(TEXTURE_CACHE_ALIGNMENT - 1);
+		levels[level].byteOffset = cursor;
+		levels[level].byteLength = levels[level].uncompressedByteLength = end - texture.levelOffsets[level];
+		cursor += levels[level].byteLength;
+	}
+
+	std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(Ktx2Level));
+	file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size() * sizeof(uint32_t));
+	file.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+	const char padding[TEXTURE_CACHE_ALIGNMENT] = {};
+	for (uint32_t level = levelCount; level-- > 0;)
+	{
+		file.write(padding, levels[level].byteOffset - static_cast<uint64_t>(file.tellp()));
+		file.write(reinterpret_cast<const char*>(texture.data.data() + texture.levelOffsets[level]), levels[level].byteLength);
+	}
+	return static_cast<bool>(file);
+}
+
+// Points "image" at the levels of a cooked texture when it was cooked from the encoded bytes hashing to
+// "sourceHash", for the same color space image.srgb asks for. The file stays mapped, KTX2 stores the
+// smallest level first so the level offsets run backwards.
+bool ReadTextureCache(const std::string& cachePath, uint64_t sourceHash, DecodedImage& image, std::string& err)
+{
+	FileView file = OpenFileView(cachePath);
+	if (!file)
+	{
+		err = "missing";
+		return false;
+	}
+	const unsigned char* data = file->Data();
+	size_t size = file->Size();
+	Ktx2Header header;
+	if (size < sizeof(header))
+	{
+		err = "truncated";
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	bool knownFormat = header.vkFormat == TEXTURE_FORMAT_BC1 || header.vkFormat == TEXTURE_FORMAT_BC1_SRGB ||
+		header.vkFormat == TEXTURE_FORMAT_BC5 || header.vkFormat == TEXTURE_FORMAT_BC7 || header.vkFormat == TEXTURE_FORMAT_BC7_SRGB;
+	if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 || !knownFormat ||
+		header.supercompressionScheme != 0 || header.pixelDepth != 0 || header.layerCount > 1 || header.faceCount != 1 ||
+		header.pixelWidth == 0 || header.pixelHeight == 0 || header.levelCount == 0 ||
+		header.levelCount > GetMipLevelCount(header.pixelWidth, header.pixelHeight) ||
+		sizeof(header) + header.levelCount * sizeof(Ktx2Level) > size ||
+		uint64_t(header.kvdByteOffset) + header.kvdByteLength > size)
+	{
+		err = "not a texture this cook step writes";
+		return false;
+	}
+	if (IsSrgbFormat(header.vkFormat) != image.srgb)
+	{
+		err = "cooked for another color space";
+		return false;
+	}
+
+	bool hashMatches = false;
+	const unsigned char* entry = data + header.kvdByteOffset;
+	const unsigned char* entriesEnd = entry + header.kvdByteLength;
+	while (entry + sizeof(uint32_t) <= entriesEnd)
+	{
+		uint32_t entryLength;
+		memcpy(&entryLength, entry, sizeof(entryLength));
+		const unsigned char* key = entry + sizeof(uint32_t);
+		if (entryLength > size_t(entriesEnd - key))
+			break;
+		if (entryLength == sizeof(TEXTURE_CACHE_HASH_KEY) + sizeof(uint64_t) &&
+			memcmp(key, TEXTURE_CACHE_HASH_KEY, sizeof(TEXTURE_CACHE_HASH_KEY)) == 0)
+		{
+			uint64_t hash;
+			memcpy(&hash, key + sizeof(TEXTURE_CACHE_HASH_KEY), sizeof(hash));
+			hashMatches = hash == sourceHash;
+		}
+		entry = key + ((entryLength + 3) & ~uint32_t(3));
+	}
+	if (!hashMatches)
+	{
+		err = "out of date";
+		return false;
+	}
+
+	std::vector<Ktx2Level> levels(header.levelCount);
+	memcpy(levels.data(), data + sizeof(header), levels.size() * sizeof(Ktx2Level));
+	uint64_t first = size, end = 0;
+	for (uint32_t level = 0; level < header.levelCount; ++level)
+	{
+		size_t expected = GetTextureLevelSize(header.vkFormat, std::max(header.pixelWidth >> level, 1u),
+			std::max(header.pixelHeight >> level, 1u));
+		if (levels[level].byteLength != expected || levels[level].byteOffset > size ||
+			levels[level].byteLength > size - levels[level].byteOffset)
+		{
+			err = "level " + std::to_string(level) + " is out of bounds";
+			return false;
+		}
+		first = std::min<uint64_t>(first, levels[level].byteOffset);
+		end = std::max<uint64_t>(end, levels[level].byteOffset + levels[level].byteLength);
+	}
+
+	image.width = header.pixelWidth;
+	image.height = header.pixelHeight;
+	image.format = header.vkFormat;
+	image.levelOffsets.resize(header.levelCount);
+	for (uint32_t level = 0; level < header.levelCount; ++level)
+		image.levelOffsets[level] = static_cast<size_t>(levels[level].byteOffset - first);
+	image.pixels.clear();
+	image.mappedLevels = data + first;
+	image.mappedSize = static_cast<size_t>(end - first);
+	image.mapping = file;
+	return true;
+}
+
+// Fills the images of "used" that have an up to date cooked texture, the others are added to "remaining"
+void ReadTextureCaches(const std::string& sourcePath, const std::vector<EncodedImage>& encoded,
+	const std::vector<int>& used, std::vector<DecodedImage>& images, std::vector<int>& remaining)
+{
+	for (int image : used)
+	{
+		std::string err = "missing"; // decoding reports an image that can't be found
+		std::string cachePath = GetTextureCachePath(sourcePath, image);
+		if (!encoded[image].data ||
+			!ReadTextureCache(cachePath, HashBytes(encoded[image].data, encoded[image].size), images[image], err))
+		{
+			if (err != "missing")
+				std::cout << "Texture cache \"" << cachePath << "\" unusable (" << err << ")" << std::endl;
+			remaining.push_back(image);
+		}
+	}
+}
+
+// Cooks every image the materials of "sourcePath" sample (see CollectMaterialImages). Color goes to BC7 (or
+// BC1 when it is opaque and "compression" asks for it), metallic-roughness to BC5 with green & blue moved
+// into its two channels.
+bool CookTextureCache(const std::string& sourcePath, TEXTURE_COMPRESSION compression, std::string& err)
+{
+	if (compression == TEXTURE_COMPRESSION_NONE)
+		return true;
+	tinygltf::TinyGLTF loader;
+	loader.SetImageLoader(KeepEncodedImage, nullptr);
+	tinygltf::Model model;
+	std::vector<FileView> files;
+	std::vector<BufferSpan> spans;
+	std::string warn;
+	if (!LoadModelFile(loader, sourcePath, model, files, spans, err, warn))
+		return false;
+
+	std::vector<GeometryMaterial> materials;
+	BuildGeometryMaterials(model, materials);
+	std::vector<DecodedImage> images;
+	std::vector<int> used;
+	CollectMaterialImages(model.images.size(), materials, images, used);
+	std::string baseDir = sourcePath.substr(0, sourcePath.find_last_of("/\\") + 1);
+	std::vector<EncodedImage> encoded;
+	GetEncodedImages(model, spans, baseDir, used, encoded);
+	if (!DecodeModelImages(encoded, used, images, err))
+		return false;
+
+	for (int image : used)
+	{
+		DecodedImage& decoded = images[image];
+		TEXTURE_FORMAT format = TEXTURE_FORMAT_BC5;
+		size_t levelSize = size_t(decoded.width) * decoded.height * 4; // the chain is filtered again after the swizzle
+		if (decoded.srgb)
+		{
+			bool opaque = true;
+			for (size_t i = 3; i < levelSize && opaque; i += 4)
+				opaque = decoded.pixels[i] == 255;
+			format = compression == TEXTURE_COMPRESSION_BC1 && opaque ? TEXTURE_FORMAT_BC1_SRGB : TEXTURE_FORMAT_BC7_SRGB;
+		}
+		else
+		{
+			// roughness (green) & metallic (blue) are all BC5 keeps, the renderer swizzles them back
+			for (size_t i = 0; i < levelSize; i += 4)
+			{
+				decoded.pixels[i] = decoded.pixels[i + 1];
+				decoded.pixels[i + 1] = decoded.pixels[i + 2];
+			}
+		}
+
+		CompressedTexture texture;
+		CompressTexture(decoded.pixels.data(), decoded.width, decoded.height, format, texture);
+		std::string cachePath = GetTextureCachePath(sourcePath, image);
+		if (!WriteTextureCache(cachePath, texture, HashBytes(encoded[image].data, encoded[image].size)))
+		{
+			err = "Unable to write \"" + cachePath + "\"";
+			return false;
+		}
+		std::cout << "Cooked image " << image << " (" << decoded.width << "x" << decoded.height << ", "
+			<< texture.levelOffsets.size() << " levels) as " << GetTextureFormatName(format) << ": "
+			<< decoded.pixels.size() << " -> " << texture.data.size() << " bytes in \"" << cachePath << "\"" << std::endl;
+	}
+	return true;
+}
+
+#endif
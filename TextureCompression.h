@@ -0,0 +1,486 @@
+// Requires Gateware (SYSTEM)
+// CPU block compression for the cook step: BC7 (mode 6) and BC1 for color, BC5 for two channel data.
+// Every encoder fits each 4x4 block to a line along its principal axis, which is quick and close
+// enough for offline use but not a match for an exhaustive encoder. Mip chains are box filtered here
+// as well, for decoded images too, so any range of levels can be uploaded on its own.
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Valued like the VkFormat each one uploads as, which is also what a KTX2 file stores
+enum TEXTURE_FORMAT
+{
+	TEXTURE_FORMAT_RGBA8 = 37, // VK_FORMAT_R8G8B8A8_UNORM
+	TEXTURE_FORMAT_RGBA8_SRGB = 43, // VK_FORMAT_R8G8B8A8_SRGB
+	TEXTURE_FORMAT_BC1 = 131, // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+	TEXTURE_FORMAT_BC1_SRGB = 132, // VK_FORMAT_BC1_RGB_SRGB_BLOCK
+	TEXTURE_FORMAT_BC5 = 141, // VK_FORMAT_BC5_UNORM_BLOCK
+	TEXTURE_FORMAT_BC7 = 145, // VK_FORMAT_BC7_UNORM_BLOCK
+	TEXTURE_FORMAT_BC7_SRGB = 146, // VK_FORMAT_BC7_SRGB_BLOCK
+};
+
+bool IsBlockCompressed(uint32_t format)
+{
+	return format != TEXTURE_FORMAT_RGBA8 && format != TEXTURE_FORMAT_RGBA8_SRGB;
+}
+
+bool IsSrgbFormat(uint32_t format)
+{
+	return format == TEXTURE_FORMAT_RGBA8_SRGB || format == TEXTURE_FORMAT_BC1_SRGB || format == TEXTURE_FORMAT_BC7_SRGB;
+}
+
+// Bytes per 4x4 block, or per texel for RGBA8
+uint32_t GetTextureBlockBytes(uint32_t format)
+{
+	if (format == TEXTURE_FORMAT_BC1 || format == TEXTURE_FORMAT_BC1_SRGB)
+		return 8;
+	return IsBlockCompressed(format) ? 16 : 4;
+}
+
+size_t GetTextureLevelSize(uint32_t format, uint32_t width, uint32_t height)
+{
+	if (!IsBlockCompressed(format))
+		return size_t(width) * height * 4;
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * GetTextureBlockBytes(format);
+}
+
+float SrgbToLinear(unsigned char value)
+{
+	struct Table
+	{
+		float linear[256];
+		Table()
+		{
+			for (int i = 0; i < 256; ++i)
+			{
+				float s = i / 255.0f;
+				linear[i] = s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	};
+	static const Table table;
+	return table.linear[value];
+}
+
+unsigned char LinearToSrgb(float value)
+{
+	value = std::min(std::max(value, 0.0f), 1.0f);
+	float s = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+	return static_cast<unsigned char>(s * 255.0f + 0.5f);
+}
+
+// 2x2 box filter of an RGBA8 level into the next one, the color of sRGB images is averaged as linear light.
+// An odd last row or column is folded into its neighbour.
+void DownsampleTextureLevel(const unsigned char* source, uint32_t width, uint32_t height, bool srgb, unsigned char* target)
+{
+	uint32_t targetWidth = std::max(width / 2, 1u);
+	uint32_t targetHeight = std::max(height / 2, 1u);
+	for (uint32_t y = 0; y < targetHeight; ++y)
+	{
+		const unsigned char* rows[2] = { source + size_t(std::min(y * 2, height - 1)) * width * 4,
+			source + size_t(std::min(y * 2 + 1, height - 1)) * width * 4 };
+		for (uint32_t x = 0; x < targetWidth; ++x)
+		{
+			uint32_t columns[2] = { std::min(x * 2, width - 1) * 4, std::min(x * 2 + 1, width - 1) * 4 };
+			unsigned char* texel = target + (size_t(y) * targetWidth + x) * 4;
+			for (int c = 0; c < 4; ++c)
+			{
+				if (srgb && c < 3)
+				{
+					float sum = SrgbToLinear(rows[0][columns[0] + c]) + SrgbToLinear(rows[0][columns[1] + c]) +
+						SrgbToLinear(rows[1][columns[0] + c]) + SrgbToLinear(rows[1][columns[1] + c]);
+					texel[c] = LinearToSrgb(sum * 0.25f);
+				}
+				else
+				{
+					unsigned int sum = rows[0][columns[0] + c] + rows[0][columns[1] + c] + rows[1][columns[0] + c] + rows[1][columns[1] + c];
+					texel[c] = static_cast<unsigned char>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+// Texels of the 4x4 block at (blockX, blockY), edges repeat their last row & column
+void LoadTextureBlock(const unsigned char* pixels, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY,
+	unsigned char block[16][4])
+{
+	for (uint32_t y = 0; y < 4; ++y)
+	{
+		uint32_t row = std::min(blockY * 4 + y, height - 1);
+		for (uint32_t x = 0; x < 4; ++x)
+		{
+			uint32_t column = std::min(blockX * 4 + x, width - 1);
+			memcpy(block[y * 4 + x], pixels + (size_t(row) * width + column) * 4, 4);
+		}
+	}
+}
+
+// End points of the line through the first "channels" channels of the block: the extreme projections
+// of its texels on their principal axis (found by power iteration on the covariance)
+void FitTextureBlockLine(const unsigned char block[16][4], int channels, float low[4], float high[4])
+{
+	float mean[4] = {};
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < channels; ++c)
+			mean[c] += block[i][c] / 16.0f;
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; ++i)
+		for (int a = 0; a < channels; ++a)
+			for (int b = 0; b < channels; ++b)
+				covariance[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+
+	// starting from the widest channel's row avoids an axis the covariance maps to zero
+	int widest = 0;
+	for (int c = 1; c < channels; ++c)
+		if (covariance[c][c] > covariance[widest][widest])
+			widest = c;
+	float axis[4] = {};
+	for (int c = 0; c < channels; ++c)
+		axis[c] = covariance[widest][c];
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[4] = {};
+		float largest = 0;
+		for (int a = 0; a < channels; ++a)
+		{
+			for (int b = 0; b < channels; ++b)
+				next[a] += covariance[a][b] * axis[b];
+			largest = std::max(largest, std::fabs(next[a]));
+		}
+		if (largest == 0)
+			break;
+		for (int c = 0; c < channels; ++c)
+			axis[c] = next[c] / largest;
+	}
+
+	float length = 0;
+	for (int c = 0; c < channels; ++c)
+		length += axis[c] * axis[c];
+	float minimum = 0, maximum = 0;
+	if (length > 0)
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			float t = 0;
+			for (int c = 0; c < channels; ++c)
+				t += (block[i][c] - mean[c]) * axis[c];
+			minimum = std::min(minimum, t / length);
+			maximum = std::max(maximum, t / length);
+		}
+	}
+	for (int c = 0; c < channels; ++c) // a flat block collapses to its mean
+	{
+		low[c] = std::min(std::max(mean[c] + axis[c] * minimum, 0.0f), 255.0f);
+		high[c] = std::min(std::max(mean[c] + axis[c] * maximum, 0.0f), 255.0f);
+	}
+}
+
+int GetColorDistance(const unsigned char* texel, const int* color, int channels)
+{
+	int distance = 0;
+	for (int c = 0; c < channels; ++c)
+		distance += (texel[c] - color[c]) * (texel[c] - color[c]);
+	return distance;
+}
+
+uint16_t PackColor565(const float color[3])
+{
+	int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+	int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+	int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void UnpackColor565(uint16_t packed, int color[3])
+{
+	int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// Opaque 4 color mode only, alpha is dropped
+void EncodeBC1Block(const unsigned char block[16][4], unsigned char* out)
+{
+	float low[4], high[4];
+	FitTextureBlockLine(block, 3, low, high);
+	uint16_t color0 = PackColor565(high), color1 = PackColor565(low);
+	if (color0 < color1)
+		std::swap(color0, color1);
+
+	uint32_t indices = 0;
+	if (color0 != color1) // equal end points would select the 3 color mode, index 0 is right for all texels then
+	{
+		int palette[4][3];
+		UnpackColor565(color0, palette[0]);
+		UnpackColor565(color1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int i = 0; i < 16; ++i)
+		{
+			uint32_t best = 0;
+			for (uint32_t p = 1; p < 4; ++p)
+				if (GetColorDistance(block[i], palette[p], 3) < GetColorDistance(block[i], palette[best], 3))
+					best = p;
+			indices |= best << (i * 2);
+		}
+	}
+	out[0] = static_cast<unsigned char>(color0);
+	out[1] = static_cast<unsigned char>(color0 >> 8);
+	out[2] = static_cast<unsigned char>(color1);
+	out[3] = static_cast<unsigned char>(color1 >> 8);
+	for (int b = 0; b < 4; ++b)
+		out[4 + b] = static_cast<unsigned char>(indices >> (b * 8));
+}
+
+// One channel in the 8 value mode, half of a BC5 block
+void EncodeBC4Block(const unsigned char block[16][4], int channel, unsigned char* out)
+{
+	int high = 0, low = 255;
+	for (int i = 0; i < 16; ++i)
+	{
+		high = std::max<int>(high, block[i][channel]);
+		low = std::min<int>(low, block[i][channel]);
+	}
+
+	uint64_t indices = 0;
+	if (high != low) // equal end points select the 6 value mode, index 0 is right for all texels then
+	{
+		int palette[8] = { high, low };
+		for (int p = 2; p < 8; ++p)
+			palette[p] = ((8 - p) * high + (p - 1) * low + 3) / 7;
+		for (int i = 0; i < 16; ++i)
+		{
+			uint64_t best = 0;
+			for (uint64_t p = 1; p < 8; ++p)
+				if (std::abs(block[i][channel] - palette[p]) < std::abs(block[i][channel] - palette[best]))
+					best = p;
+			indices |= best << (i * 3);
+		}
+	}
+	out[0] = static_cast<unsigned char>(high);
+	out[1] = static_cast<unsigned char>(low);
+	for (int b = 0; b < 6; ++b)
+		out[2 + b] = static_cast<unsigned char>(indices >> (b * 8));
+}
+
+void EncodeBC5Block(const unsigned char block[16][4], int channel0, int channel1, unsigned char* out)
+{
+	EncodeBC4Block(block, channel0, out);
+	EncodeBC4Block(block, channel1, out + 8);
+}
+
+// Little endian bit stream of one 128-bit block
+struct TextureBlockBits
+{
+	unsigned char* bytes;
+	int position = 0;
+
+	explicit TextureBlockBits(unsigned char* _bytes) : bytes(_bytes) { memset(bytes, 0, 16); }
+
+	void Put(uint32_t value, int count)
+	{
+		for (int b = 0; b < count; ++b, ++position)
+			if ((value >> b) & 1)
+				bytes[position >> 3] |= 1 << (position & 7);
+	}
+};
+
+const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Mode 6: one RGBA subset with 7-bit end points plus a p-bit each and 4-bit indices.
+// All four p-bit pairs are tried, the one with the least squared error is written.
+void EncodeBC7Block(const unsigned char block[16][4], unsigned char* out)
+{
+	float low[4], high[4];
+	FitTextureBlockLine(block, 4, low, high);
+
+	int bestError = -1;
+	int bestEndpoints[2][4] = {}, bestBits[2] = {};
+	uint32_t bestIndices[16] = {};
+	for (int pair = 0; pair < 4; ++pair)
+	{
+		int bits[2] = { pair & 1, pair >> 1 };
+		int endpoints[2][4], colors[2][4];
+		for (int c = 0; c < 4; ++c)
+		{
+			const float values[2] = { low[c], high[c] };
+			for (int e = 0; e < 2; ++e)
+			{
+				endpoints[e][c] = std::min(std::max(static_cast<int>((values[e] - bits[e]) / 2.0f + 0.5f), 0), 127);
+				colors[e][c] = (endpoints[e][c] << 1) | bits[e];
+			}
+		}
+		int palette[16][4];
+		for (int p = 0; p < 16; ++p)
+			for (int c = 0; c < 4; ++c)
+				palette[p][c] = ((64 - BC7_WEIGHTS4[p]) * colors[0][c] + BC7_WEIGHTS4[p] * colors[1][c] + 32) >> 6;
+
+		int error = 0;
+		uint32_t indices[16];
+		for (int i = 0; i < 16; ++i)
+		{
+			uint32_t best = 0;
+			int bestDistance = GetColorDistance(block[i], palette[0], 4);
+			for (uint32_t p = 1; p < 16; ++p)
+			{
+				int distance = GetColorDistance(block[i], palette[p], 4);
+				if (distance < bestDistance)
+				{
+					best = p;
+					bestDistance = distance;
+				}
+			}
+			indices[i] = best;
+			error += bestDistance;
+		}
+		if (bestError < 0 || error < bestError)
+		{
+			bestError = error;
+			memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+			memcpy(bestBits, bits, sizeof(bits));
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+	}
+
+	// the first texel's index is stored without its top bit, swapping the end points clears it
+	if (bestIndices[0] & 8)
+	{
+		for (int c = 0; c < 4; ++c)
+			std::swap(bestEndpoints[0][c], bestEndpoints[1][c]);
+		std::swap(bestBits[0], bestBits[1]);
+		for (int i = 0; i < 16; ++i)
+			bestIndices[i] = 15 - bestIndices[i];
+	}
+
+	TextureBlockBits stream(out);
+	stream.Put(1 << 6, 7); // mode 6
+	for (int c = 0; c < 4; ++c)
+	{
+		stream.Put(bestEndpoints[0][c], 7);
+		stream.Put(bestEndpoints[1][c], 7);
+	}
+	stream.Put(bestBits[0], 1);
+	stream.Put(bestBits[1], 1);
+	stream.Put(bestIndices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		stream.Put(bestIndices[i], 4);
+}
+
+// A texture cooked into one TEXTURE_FORMAT, every level back to back with level 0 first
+struct CompressedTexture
+{
+	uint32_t format = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<unsigned char> data;
+	std::vector<size_t> levelOffsets; // into data, one per mip level
+};
+
+// Appends the whole mip chain below the RGBA8 level 0 in "pixels", level by level with level 0 first
+void BuildTextureLevels(std::vector<unsigned char>& pixels, uint32_t width, uint32_t height, bool srgb,
+	std::vector<size_t>& levelOffsets)
+{
+	levelOffsets.assign(1, 0);
+	size_t size = size_t(width) * height * 4;
+	for (uint32_t w = width, h = height; w > 1 || h > 1; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u))
+		size += size_t(std::max(w / 2, 1u)) * std::max(h / 2, 1u) * 4;
+	pixels.resize(size);
+	for (uint32_t w = width, h = height; w > 1 || h > 1; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u))
+	{
+		size_t source = levelOffsets.back();
+		levelOffsets.push_back(source + size_t(w) * h * 4);
+		DownsampleTextureLevel(pixels.data() + source, w, h, srgb, pixels.data() + levelOffsets.back());
+	}
+}
+
+struct TextureBlockRow
+{
+	uint32_t level;
+	uint32_t row;
+};
+
+struct TextureCompressContext
+{
+	const std::vector<unsigned char>* levels; // RGBA8 mip chain
+	const std::vector<size_t>* levelOffsets; // into levels
+	CompressedTexture* texture;
+};
+
+// BranchParallel task, a row of blocks only writes its own part of the level
+void CompressTextureBlockRowTask(const TextureBlockRow* blockRow, int*, unsigned int, const void* userData)
+{
+	const TextureCompressContext* context = static_cast<const TextureCompressContext*>(userData);
+	CompressedTexture& texture = *context->texture;
+	uint32_t width = std::max(texture.width >> blockRow->level, 1u);
+	uint32_t height = std::max(texture.height >> blockRow->level, 1u);
+	const unsigned char* pixels = context->levels->data() + (*context->levelOffsets)[blockRow->level];
+	uint32_t blockBytes = GetTextureBlockBytes(texture.format);
+	uint32_t blocksWide = (width + 3) / 4;
+	unsigned char* out = texture.data.data() + texture.levelOffsets[blockRow->level] + size_t(blockRow->row) * blocksWide * blockBytes;
+
+	unsigned char block[16][4];
+	for (uint32_t x = 0; x < blocksWide; ++x, out += blockBytes)
+	{
+		LoadTextureBlock(pixels, width, height, x, blockRow->row, block);
+		if (texture.format == TEXTURE_FORMAT_BC1 || texture.format == TEXTURE_FORMAT_BC1_SRGB)
+			EncodeBC1Block(block, out);
+		else if (texture.format == TEXTURE_FORMAT_BC5)
+			EncodeBC5Block(block, 0, 1, out);
+		else
+			EncodeBC7Block(block, out);
+	}
+}
+
+// Box filters the whole mip chain of an RGBA8 image, then compresses every level into "format"
+// with the block rows spread over the Gateware thread pool
+void CompressTexture(const unsigned char* pixels, uint32_t width, uint32_t height, TEXTURE_FORMAT format,
+	CompressedTexture& texture)
+{
+	texture.format = format;
+	texture.width = width;
+	texture.height = height;
+	std::vector<unsigned char> levels(pixels, pixels + size_t(width) * height * 4);
+	std::vector<size_t> levelOffsets;
+	BuildTextureLevels(levels, width, height, IsSrgbFormat(format), levelOffsets);
+
+	std::vector<TextureBlockRow> blockRows;
+	size_t size = 0;
+	texture.levelOffsets.resize(levelOffsets.size());
+	for (uint32_t level = 0; level < levelOffsets.size(); ++level)
+	{
+		uint32_t levelWidth = std::max(width >> level, 1u), levelHeight = std::max(height >> level, 1u);
+		texture.levelOffsets[level] = size;
+		size += GetTextureLevelSize(format, levelWidth, levelHeight);
+		for (uint32_t row = 0; row < (levelHeight + 3) / 4; ++row)
+			blockRows.push_back(TextureBlockRow{ level, row });
+	}
+	texture.data.resize(size);
+
+	TextureCompressContext context = { &levels, &levelOffsets, &texture };
+	std::vector<int> results(blockRows.size());
+	unsigned int count = static_cast<unsigned int>(blockRows.size());
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int section = std::max(1u, count / (threads * 4));
+	GW::SYSTEM::GConcurrent concurrent;
+	if (-concurrent.Create(true) ||
+		-concurrent.BranchParallel(CompressTextureBlockRowTask, section, count, &context, 0, blockRows.data(), 0, results.data()))
+	{
+		for (unsigned int i = 0; i < count; ++i) // the pool is unavailable
+			CompressTextureBlockRowTask(&blockRows[i], &results[i], i, &context);
+	}
+	else
+		concurrent.Converge(0);
+}
+
+#endif
@@ -0,0 +1,321 @@
+// Requires TinyGLTF (stb_image), Gateware (SYSTEM), MappedFile.h, FileService.h, GLBLoader.h, SceneGeometry.h & TextureCompression.h
+// CPU side of the texture pipeline: the images the materials sample are decoded to RGBA8 and box
+// filtered into their mip chains on the Gateware thread pool, the renderer streams their levels in.
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct DecodedImage
+{
+	uint32_t width = 0; // 0 for images no material samples
+	uint32_t height = 0;
+	bool srgb = false; // color data, everything else is sampled as linear values
+	std::vector<unsigned char> pixels; // every level with tightly packed rows, level 0 first
+	uint32_t format = 0; // TEXTURE_FORMAT, RGBA8 when decoded here, block compressed when cooked (TextureCache.h)
+	std::vector<size_t> levelOffsets; // into the levels, one per level, not in order when they are mapped from a KTX2
+	FileView mapping; // holds the levels instead of pixels when they came from the image or texture cache
+	const unsigned char* mappedLevels = nullptr;
+	size_t mappedSize = 0;
+
+	const unsigned char* GetLevels() const { return mapping ? mappedLevels : pixels.data(); }
+	size_t GetLevelsSize() const { return mapping ? mappedSize : pixels.size(); }
+	size_t GetLevelSize(size_t level) const
+	{
+		return GetTextureLevelSize(format, std::max(width >> level, 1u), std::max(height >> level, 1u));
+	}
+};
+
+// tinygltf decodes every image serially while it parses, this keeps the encoded bytes for DecodeModelImages
+bool KeepEncodedImage(tinygltf::Image* image, const int, std::string*, std::string*, int, int,
+	const unsigned char* bytes, int size, void*)
+{
+	image->image.assign(bytes, bytes + size);
+	image->as_is = true;
+	return true;
+}
+
+uint32_t GetMipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	while ((width | height) >> levels)
+		++levels;
+	return levels;
+}
+
+bool GeometryUsesTextures(const SceneGeometry& geometry)
+{
+	for (const GeometryMaterial& material : geometry.materials)
+	{
+		if (material.baseColorTexture >= 0)
+			return true;
+	}
+	return false;
+}
+
+// Flags the images sampled by the base color textures of "materials" in "images", sized like the model's
+// "imageCount" images. Metallic-roughness is left out until a shader samples it.
+void CollectMaterialImages(size_t imageCount, const std::vector<GeometryMaterial>& materials,
+	std::vector<DecodedImage>& images, std::vector<int>& used)
+{
+	images.assign(imageCount, DecodedImage());
+	used.clear();
+	for (const GeometryMaterial& material : materials)
+	{
+		int image = material.baseColorImage;
+		if (image < 0 || image >= static_cast<int>(imageCount))
+			continue;
+		if (std::find(used.begin(), used.end(), image) == used.end())
+			used.push_back(image);
+		images[image].srgb = true;
+	}
+}
+
+// File an image is read from, empty when it is embedded in the model
+std::string GetImageFilePath(const tinygltf::Image& image, const std::string& baseDir)
+{
+	std::string fileName;
+	if ((image.as_is && !image.image.empty()) || image.bufferView >= 0 || image.uri.empty() ||
+		tinygltf::IsDataURI(image.uri) || !tinygltf::URIDecode(image.uri, &fileName, nullptr))
+		return std::string();
+	return baseDir + fileName;
+}
+
+// The still encoded bytes of an image, wherever the model keeps them
+struct EncodedImage
+{
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+	std::vector<unsigned char> dataURI; // backs data when the image is a data URI
+	FileView file; // backs data when the image is a file next to the model
+	std::string err; // why data is null
+};
+
+// Finds image "index" of "model": kept by KeepEncodedImage, in a bufferView, in a data URI or in a
+// file next to the model (mapped, not read onto the heap)
+bool GetEncodedImage(const tinygltf::Model& model, const std::vector<BufferSpan>& spans, const std::string& baseDir,
+	int index, EncodedImage& encoded, std::string& err)
+{
+	const tinygltf::Image& image = model.images[index];
+	std::string name = "Image " + std::to_string(index);
+	if (image.as_is && !image.image.empty())
+	{
+		encoded.data = image.image.data();
+		encoded.size = image.image.size();
+	}
+	else if (image.bufferView >= 0)
+	{
+		if (image.bufferView >= static_cast<int>(model.bufferViews.size()))
+		{
+			err = name + " has an invalid bufferView";
+			return false;
+		}
+		const tinygltf::BufferView& view = model.bufferViews[image.bufferView];
+		if (view.buffer < 0 || view.buffer >= static_cast<int>(spans.size()) ||
+			view.byteOffset + view.byteLength > spans[view.buffer].size)
+		{
+			err = name + " reads past the end of its buffer";
+			return false;
+		}
+		encoded.data = spans[view.buffer].data + view.byteOffset;
+		encoded.size = view.byteLength;
+	}
+	else if (tinygltf::IsDataURI(image.uri))
+	{
+		std::string mimeType;
+		if (!tinygltf::DecodeDataURI(&encoded.dataURI, mimeType, image.uri, 0, false))
+		{
+			err = name + " has an invalid data URI";
+			return false;
+		}
+		encoded.data = encoded.dataURI.data();
+		encoded.size = encoded.dataURI.size();
+	}
+	else
+	{
+		std::string filePath = GetImageFilePath(image, baseDir);
+		if (filePath.empty() || !(encoded.file = OpenFileView(filePath)))
+		{
+			err = name + " could not open \"" + filePath + "\"";
+			return false;
+		}
+		encoded.data = encoded.file->Data();
+		encoded.size = encoded.file->Size();
+	}
+	return true;
+}
+
+// GetEncodedImage for every image of "used", "encoded" is indexed like the model's images
+void GetEncodedImages(const tinygltf::Model& model, const std::vector<BufferSpan>& spans, const std::string& baseDir,
+	const std::vector<int>& used, std::vector<EncodedImage>& encoded)
+{
+	encoded.clear();
+	encoded.resize(model.images.size());
+	for (int image : used)
+		GetEncodedImage(model, spans, baseDir, image, encoded[image], encoded[image].err);
+}
+
+// Where the encoded bytes of an image are on disk, so they can be found again without parsing the glTF
+struct ImageLocation
+{
+	std::string path; // relative to the model's folder, empty when only the parsed model has the bytes (data URIs)
+	uint64_t offset = 0;
+	uint64_t size = 0; // 0 when the image is the whole file
+};
+
+// Locates every image of "model" loaded from "sourcePath" by LoadModelFile, "files" are the mappings it kept
+void GetImageLocations(const tinygltf::Model& model, const std::vector<BufferSpan>& spans,
+	const std::vector<FileView>& files, const std::string& sourcePath, std::vector<ImageLocation>& locations)
+{
+	std::string baseDir = sourcePath.substr(0, sourcePath.find_last_of("/\\") + 1);
+	locations.assign(model.images.size(), ImageLocation());
+	for (size_t i = 0; i < model.images.size(); ++i)
+	{
+		const tinygltf::Image& image = model.images[i];
+		ImageLocation& location = locations[i];
+		std::string fileName;
+		if (image.bufferView >= 0 && image.bufferView < static_cast<int>(model.bufferViews.size()))
+		{
+			const tinygltf::BufferView& view = model.bufferViews[image.bufferView];
+			if (view.buffer < 0 || view.buffer >= static_cast<int>(model.buffers.size()) || view.byteLength == 0)
+				continue;
+			const tinygltf::Buffer& buffer = model.buffers[view.buffer];
+			const unsigned char* data = spans[view.buffer].data;
+			if (!buffer.uri.empty() && !tinygltf::IsDataURI(buffer.uri) && tinygltf::URIDecode(buffer.uri, &fileName, nullptr))
+			{
+				location.path = fileName;
+				location.offset = view.byteOffset;
+			}
+			else if (buffer.uri.empty() && IsGLBFile(sourcePath) && files.size() == 1 && data >= files[0]->Data() &&
+				data < files[0]->Data() + files[0]->Size())
+			{
+				// the BIN chunk of a GLB that was mapped, tinygltf's own loader leaves no offset to record
+				location.path = sourcePath.substr(baseDir.size());
+				location.offset = (data - files[0]->Data()) + view.byteOffset;
+			}
+			else
+				continue;
+			location.size = view.byteLength;
+		}
+		else if (image.bufferView < 0 && !image.uri.empty() && !tinygltf::IsDataURI(image.uri) &&
+			tinygltf::URIDecode(image.uri, &fileName, nullptr))
+		{
+			location.path = fileName;
+		}
+	}
+}
+
+// True when GetImageLocations found every image of "used"
+bool AreImagesLocated(const std::vector<ImageLocation>& locations, const std::vector<int>& used)
+{
+	for (int image : used)
+	{
+		if (image >= static_cast<int>(locations.size()) || locations[image].path.empty())
+			return false;
+	}
+	return true;
+}
+
+// GetEncodedImages from the locations of an earlier parse, the files are mapped, not read
+void LocateEncodedImages(const std::string& baseDir, const std::vector<ImageLocation>& locations,
+	const std::vector<int>& used, std::vector<EncodedImage>& encoded)
+{
+	encoded.clear();
+	encoded.resize(locations.size());
+	for (int image : used)
+	{
+		const ImageLocation& location = locations[image];
+		EncodedImage& target = encoded[image];
+		target.file = OpenFileView(baseDir + location.path);
+		uint64_t size = target.file ? target.file->Size() : 0;
+		if (!target.file || location.offset > size || location.size > size - location.offset)
+		{
+			target.file.reset();
+			target.err = "Image " + std::to_string(image) + " could not be read from \"" + baseDir + location.path + "\"";
+			continue;
+		}
+		target.data = target.file->Data() + location.offset;
+		target.size = static_cast<size_t>(location.size ? location.size : size - location.offset);
+	}
+}
+
+// Decodes image "index" to RGBA8 and builds its mip chain, in linear light for sRGB images
+bool DecodeModelImage(const EncodedImage& encoded, int index, DecodedImage& decoded, std::string& err)
+{
+	if (!encoded.data)
+	{
+		err = encoded.err;
+		return false;
+	}
+
+	int width, height, components;
+	unsigned char* pixels = stbi_load_from_memory(encoded.data, static_cast<int>(encoded.size), &width, &height, &components,
+		STBI_rgb_alpha);
+	if (!pixels)
+	{
+		err = "Image " + std::to_string(index) + " could not be decoded: " + stbi_failure_reason();
+		return false;
+	}
+	decoded.width = static_cast<uint32_t>(width);
+	decoded.height = static_cast<uint32_t>(height);
+	decoded.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+	stbi_image_free(pixels);
+	decoded.format = decoded.srgb ? TEXTURE_FORMAT_RGBA8_SRGB : TEXTURE_FORMAT_RGBA8;
+	BuildTextureLevels(decoded.pixels, decoded.width, decoded.height, decoded.srgb, decoded.levelOffsets);
+	return true;
+}
+
+struct ImageDecodeResult
+{
+	bool decoded = false;
+	std::string err;
+};
+
+struct ImageDecodeContext
+{
+	const std::vector<EncodedImage>* encoded;
+	std::vector<DecodedImage>* images;
+};
+
+// BranchParallel task, every image writes only its own entry of "images"
+void DecodeModelImageTask(const int* image, ImageDecodeResult* result, unsigned int, const void* userData)
+{
+	const ImageDecodeContext* context = static_cast<const ImageDecodeContext*>(userData);
+	result->decoded = DecodeModelImage((*context->encoded)[*image], *image, (*context->images)[*image], result->err);
+}
+
+// Decodes the images in "used" one per task, images take long enough that they never share a section.
+// Waits for the pool, so it must not be called from inside a pool job.
+bool DecodeModelImages(const std::vector<EncodedImage>& encoded, const std::vector<int>& used,
+	std::vector<DecodedImage>& images, std::string& err)
+{
+	std::vector<ImageDecodeResult> results(used.size());
+	ImageDecodeContext context = { &encoded, &images };
+	unsigned int count = static_cast<unsigned int>(used.size());
+
+	GW::SYSTEM::GConcurrent concurrent;
+	if (count <= 1 || -concurrent.Create(true) ||
+		-concurrent.BranchParallel(DecodeModelImageTask, 1, count, &context, 0, used.data(), 0, results.data()))
+	{
+		for (unsigned int i = 0; i < count; ++i) // a single image, or the pool is unavailable
+			DecodeModelImageTask(&used[i], &results[i], i, &context);
+	}
+	else
+		concurrent.Converge(0);
+
+	for (const ImageDecodeResult& result : results)
+	{
+		if (!result.decoded)
+		{
+			err = result.err;
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
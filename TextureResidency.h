@@ -0,0 +1,186 @@
+// Requires SceneGeometry.h & TextureCompression.h
+// Mip residency of streamed textures: which level every texture needs for what its draws cover on
+// screen, and which levels fit a memory budget. The mip tail of every texture always stays resident,
+// finer levels are evicted from the texture that needed them least recently (LRU) to make room. The budget
+// is spent in the bytes the GPU allocator hands out for each texture, not in the bytes of its levels.
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+const uint32_t TEXTURE_TAIL_SIZE = 64; // levels this size or smaller are uploaded with the model and never evicted
+
+struct TextureResidency
+{
+	uint32_t format = 0; // TEXTURE_FORMAT
+	uint32_t width = 0; // of level 0
+	uint32_t height = 0;
+	uint32_t levelCount = 0;
+	uint32_t tailLevel = 0; // first level of the mip tail
+	uint32_t residentLevel = 0; // first level on the GPU, every level after it is too
+	uint32_t wantedLevel = 0; // first level the draws on screen sample
+	uint64_t lastUsed = 0; // last update that sampled every resident level
+	std::vector<uint64_t> allocationSizes; // GPU bytes of a texture holding the levels from each level on, up to tailLevel
+};
+
+void InitializeTextureResidency(uint32_t format, uint32_t width, uint32_t height, uint32_t levelCount,
+	TextureResidency& texture)
+{
+	texture = TextureResidency();
+	texture.format = format;
+	texture.width = width;
+	texture.height = height;
+	texture.levelCount = levelCount;
+	while (texture.tailLevel + 1 < levelCount &&
+		std::max(width >> texture.tailLevel, height >> texture.tailLevel) > TEXTURE_TAIL_SIZE)
+		++texture.tailLevel;
+	texture.residentLevel = texture.wantedLevel = texture.tailLevel;
+}
+
+// Bytes of every level from "firstLevel" on, what uploading them costs
+size_t GetTextureLevelsSize(const TextureResidency& texture, uint32_t firstLevel)
+{
+	size_t size = 0;
+	for (uint32_t level = firstLevel; level < texture.levelCount; ++level)
+		size += GetTextureLevelSize(texture.format, std::max(texture.width >> level, 1u), std::max(texture.height >> level, 1u));
+	return size;
+}
+
+// Bytes the GPU spends on a texture holding the levels from "firstLevel" on, the levels themselves when
+// the allocation sizes weren't filled in
+size_t GetTextureResidentSize(const TextureResidency& texture, uint32_t firstLevel)
+{
+	if (firstLevel < texture.allocationSizes.size() && texture.allocationSizes[firstLevel])
+		return static_cast<size_t>(texture.allocationSizes[firstLevel]);
+	return GetTextureLevelsSize(texture, firstLevel);
+}
+
+// Sets wantedLevel of every texture to about a texel per pixel, from the bounding sphere of every draw that
+// samples it. A material's UVs are taken to cover its textures once across the draw. "view" is the row
+// vector world to view matrix, "projectionScale" the y scale of the projection. Textures of draws behind
+// the camera only want their tail.
+void UpdateWantedTextureLevels(const SceneGeometry& geometry, const std::vector<int32_t>& materialImages,
+	uint32_t imagesPerMaterial, const float view[16], float projectionScale, uint32_t viewportHeight, uint64_t update,
+	std::vector<TextureResidency>& textures)
+{
+	for (TextureResidency& texture : textures)
+		texture.wantedLevel = texture.tailLevel;
+
+	for (size_t i = 0; i < geometry.draws.size(); ++i)
+	{
+		int32_t material = geometry.draws[i].material;
+		if (material < 0 || (material + 1) * imagesPerMaterial > materialImages.size())
+			continue;
+
+		// the world matrix is column major like glTF, the sphere takes its largest axis scale
+		const GeometryBounds& bounds = geometry.bounds[i];
+		const float* world = geometry.transforms[i].matrix;
+		float local[3], extent = 0, scale = 0;
+		for (int c = 0; c < 3; ++c)
+		{
+			local[c] = (bounds.min[c] + bounds.max[c]) * 0.5f;
+			extent += (bounds.max[c] - bounds.min[c]) * (bounds.max[c] - bounds.min[c]) * 0.25f;
+			scale = std::max(scale, world[c * 4] * world[c * 4] + world[c * 4 + 1] * world[c * 4 + 1] +
+				world[c * 4 + 2] * world[c * 4 + 2]);
+		}
+		float radius = std::sqrt(extent * scale);
+		float center[3], eye[3];
+		for (int r = 0; r < 3; ++r)
+			center[r] = world[r] * local[0] + world[4 + r] * local[1] + world[8 + r] * local[2] + world[12 + r];
+		for (int c = 0; c < 3; ++c)
+			eye[c] = center[0] * view[c] + center[1] * view[4 + c] + center[2] * view[8 + c] + view[12 + c];
+		if (eye[2] + radius <= 0)
+			continue;
+
+		float distance = std::max(std::sqrt(eye[0] * eye[0] + eye[1] * eye[1] + eye[2] * eye[2]), radius);
+		float pixels = std::max(radius / distance * projectionScale * viewportHeight, 1.0f); // across the sphere
+		for (uint32_t j = 0; j < imagesPerMaterial; ++j)
+		{
+			int32_t image = materialImages[material * imagesPerMaterial + j];
+			if (image < 0 || image >= static_cast<int32_t>(textures.size()) || textures[image].levelCount == 0)
+				continue;
+			TextureResidency& texture = textures[image];
+			float texels = static_cast<float>(std::max(texture.width, texture.height));
+			int32_t level = static_cast<int32_t>(std::floor(std::log2(std::max(texels / pixels, 1.0f))));
+			texture.wantedLevel = std::min(texture.wantedLevel, static_cast<uint32_t>(std::min<int32_t>(level, texture.tailLevel)));
+		}
+	}
+
+	for (TextureResidency& texture : textures)
+	{
+		if (texture.levelCount && texture.wantedLevel <= texture.residentLevel)
+			texture.lastUsed = update;
+	}
+}
+
+// Picks the next residentLevel of every texture into "targetLevels". Textures missing the most levels are
+// refined first, a level at a time, while the chains their replacements upload fit "uploadLimit" (a single
+// texture whose chain alone is larger still gets it). Levels no draw samples are evicted, least recently
+// used first, once a refinement would exceed "budget". Returns the GPU bytes the planned textures take.
+size_t PlanTextureResidency(const std::vector<TextureResidency>& textures, size_t budget, size_t uploadLimit,
+	std::vector<uint32_t>& targetLevels)
+{
+	size_t resident = 0;
+	std::vector<size_t> refinements, evictions;
+	targetLevels.resize(textures.size());
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		const TextureResidency& texture = textures[i];
+		targetLevels[i] = texture.residentLevel;
+		if (texture.levelCount == 0)
+			continue;
+		resident += GetTextureResidentSize(texture, texture.residentLevel);
+		if (texture.wantedLevel < texture.residentLevel)
+			refinements.push_back(i);
+		else if (texture.wantedLevel > texture.residentLevel)
+			evictions.push_back(i);
+	}
+	std::sort(refinements.begin(), refinements.end(), [&](size_t a, size_t b) {
+		return textures[a].residentLevel - textures[a].wantedLevel > textures[b].residentLevel - textures[b].wantedLevel;
+	});
+	std::sort(evictions.begin(), evictions.end(), [&](size_t a, size_t b) {
+		return textures[a].lastUsed < textures[b].lastUsed;
+	});
+
+	size_t nextEviction = 0;
+	auto evict = [&]()
+	{
+		const TextureResidency& texture = textures[evictions[nextEviction]];
+		resident -= GetTextureResidentSize(texture, texture.residentLevel) - GetTextureResidentSize(texture, texture.wantedLevel);
+		targetLevels[evictions[nextEviction++]] = texture.wantedLevel;
+	};
+	// a lowered budget is met before anything is refined
+	while (resident > budget && nextEviction < evictions.size())
+		evict();
+
+	// a refined texture is replaced, so its whole chain from the new level on is uploaded again
+	size_t uploaded = 0;
+	for (size_t i : refinements)
+	{
+		const TextureResidency& texture = textures[i];
+		size_t chain = 0; // planned for this texture so far
+		while (targetLevels[i] > texture.wantedLevel)
+		{
+			uint32_t level = targetLevels[i] - 1;
+			size_t nextChain = GetTextureLevelsSize(texture, level);
+			if (uploaded - chain + nextChain > uploadLimit && uploaded != chain)
+				break;
+			size_t growth = GetTextureResidentSize(texture, level) - GetTextureResidentSize(texture, targetLevels[i]);
+			while (resident + growth > budget && nextEviction < evictions.size())
+				evict();
+			if (resident + growth > budget)
+				break;
+			resident += growth;
+			uploaded += nextChain - chain;
+			chain = nextChain;
+			targetLevels[i] = level;
+		}
+		if (uploaded >= uploadLimit)
+			break;
+	}
+	return resident;
+}
+
+#endif
@@ -0,0 +1,117 @@
+// Requires SceneGeometry.h & VertexQuantization.h
+// How the vertex streams of a SceneGeometry are arranged in the GPU buffer. The geometry itself
+// always stays one stream per attribute, other layouts are packed straight into staging memory.
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+enum VERTEX_LAYOUT
+{
+	VERTEX_LAYOUT_SEPARATE = 0, // one binding per attribute
+	VERTEX_LAYOUT_INTERLEAVED, // every attribute in a single binding
+	VERTEX_LAYOUT_POSITION_SPLIT, // positions alone (depth/shadow passes), the other attributes interleaved
+	VERTEX_LAYOUT_COUNT
+};
+
+const char* const VERTEX_LAYOUT_NAMES[VERTEX_LAYOUT_COUNT] = { "separate", "interleaved", "split" };
+
+// Streams the model doesn't have are read from one constant element per stream, through a
+// binding with stride 0, so the shader's inputs never change with the model
+const uint32_t VERTEX_DEFAULT_ELEMENT_SIZE = 16;
+
+// Where every GEOMETRY_STREAM ends up: its binding and byte offset inside that binding's element
+struct PackedVertexLayout
+{
+	uint32_t bindingCount;
+	uint32_t bindingStrides[GEOMETRY_STREAM_COUNT];
+	uint32_t streamBinding[GEOMETRY_STREAM_COUNT];
+	uint32_t streamOffset[GEOMETRY_STREAM_COUNT];
+	uint32_t defaultsBinding; // bindingCount when every stream is present
+	uint32_t defaultsSize;
+};
+
+bool ParseVertexLayout(const std::string& name, VERTEX_LAYOUT& layout)
+{
+	for (int i = 0; i < VERTEX_LAYOUT_COUNT; ++i)
+	{
+		if (name == VERTEX_LAYOUT_NAMES[i])
+		{
+			layout = static_cast<VERTEX_LAYOUT>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+PackedVertexLayout GetPackedVertexLayout(const SceneGeometry& geometry, VERTEX_LAYOUT layout)
+{
+	PackedVertexLayout packed = {};
+	uint32_t separateBinding = 0; // bindings stay dense when streams are missing
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		if (geometry.vertexStrides[i] == 0)
+			continue;
+		uint32_t binding = 0;
+		if (layout == VERTEX_LAYOUT_SEPARATE)
+			binding = separateBinding++;
+		else if (layout == VERTEX_LAYOUT_POSITION_SPLIT)
+			binding = i == GEOMETRY_STREAM_POSITION ? 0 : 1;
+
+		packed.streamBinding[i] = binding;
+		packed.streamOffset[i] = packed.bindingStrides[binding];
+		packed.bindingStrides[binding] += geometry.vertexStrides[i]; // strides are multiples of 4, so is every offset
+		packed.bindingCount = std::max(packed.bindingCount, binding + 1);
+	}
+
+	packed.defaultsBinding = packed.bindingCount;
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		if (geometry.vertexStrides[i] != 0)
+			continue;
+		packed.streamBinding[i] = packed.defaultsBinding;
+		packed.streamOffset[i] = packed.defaultsSize;
+		packed.defaultsSize += VERTEX_DEFAULT_ELEMENT_SIZE;
+	}
+	if (packed.defaultsSize > 0)
+		packed.bindingStrides[packed.bindingCount++] = 0;
+	return packed;
+}
+
+// Bytes PackVertexBinding writes for "binding"
+size_t GetPackedBindingSize(const SceneGeometry& geometry, const PackedVertexLayout& packed, uint32_t binding)
+{
+	if (binding == packed.defaultsBinding)
+		return packed.defaultsSize;
+	return size_t(packed.bindingStrides[binding]) * geometry.vertexCount;
+}
+
+// Writes "binding" for every vertex of the pool into "out" (GetPackedBindingSize bytes)
+void PackVertexBinding(const SceneGeometry& geometry, const PackedVertexLayout& packed, uint32_t binding,
+	unsigned char* out)
+{
+	if (binding == packed.defaultsBinding)
+	{
+		memset(out, 0, packed.defaultsSize);
+		for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+			if (packed.streamBinding[i] == binding)
+				EncodeStreamDefault(geometry.vertexFormat, i, out + packed.streamOffset[i]);
+		return;
+	}
+	uint32_t stride = packed.bindingStrides[binding];
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		if (packed.streamBinding[i] != binding)
+			continue;
+		uint32_t size = geometry.vertexStrides[i];
+		if (size == stride) // the stream has the binding to itself
+		{
+			memcpy(out, geometry.vertexStreams[i].data, size_t(size) * geometry.vertexCount);
+			continue;
+		}
+		const unsigned char* source = geometry.vertexStreams[i].data;
+		unsigned char* destination = out + packed.streamOffset[i];
+		for (uint32_t v = 0; v < geometry.vertexCount; ++v)
+			memcpy(destination + size_t(v) * stride, source + size_t(v) * size, size);
+	}
+}
+
+#endif
@@ -0,0 +1,189 @@
+// Requires SceneGeometry.h
+// Compact vertex format, 20 bytes per vertex instead of 48:
+// POSITION  4 x unorm16, xyz relative to the primitive's bounds, w holds the tangent's sign
+// NORMAL    2 x snorm16, octahedral
+// TEXCOORD  2 x half
+// TANGENT   2 x snorm16, octahedral
+// The bounds double as the dequantization transform, so the mesh cache needs no extra data.
+#ifndef VERTEX_QUANTIZATION_H
+#define VERTEX_QUANTIZATION_H
+
+#include <cmath>
+
+const uint32_t QUANTIZED_STREAM_STRIDES[GEOMETRY_STREAM_COUNT] = { 8, 4, 4, 4 };
+
+// Files written with KHR_mesh_quantization already chose compact attributes, keep them compact
+bool ModelUsesMeshQuantization(const tinygltf::Model& model)
+{
+	return std::find(model.extensionsUsed.begin(), model.extensionsUsed.end(), "KHR_mesh_quantization") !=
+		model.extensionsUsed.end();
+}
+
+uint16_t QuantizeUnorm16(float value)
+{
+	return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+}
+
+int16_t QuantizeSnorm16(float value)
+{
+	return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+}
+
+// Round to nearest, values beyond the half range clamp to the largest finite half
+uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	if (magnitude > 0x7f800000)
+		return sign | 0x7e00; // NaN
+	if (magnitude >= 0x477ff000)
+		return sign | 0x7bff;
+	if (magnitude < 0x33000000)
+		return sign; // below half a subnormal step
+	if (magnitude < 0x38800000) // subnormal half
+	{
+		uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+		uint32_t shift = 126 - (magnitude >> 23);
+		return sign | static_cast<uint16_t>((mantissa + (1u << (shift - 1))) >> shift);
+	}
+	return sign | static_cast<uint16_t>((magnitude - 0x38000000 + 0xfff + ((magnitude >> 13) & 1)) >> 13);
+}
+
+// Folds a unit vector onto the octahedron and unfolds it into [-1, 1]^2
+void EncodeOctahedral(const float* vector, int16_t* out)
+{
+	float length = std::fabs(vector[0]) + std::fabs(vector[1]) + std::fabs(vector[2]);
+	float x = length > 0.0f ? vector[0] / length : 0.0f;
+	float y = length > 0.0f ? vector[1] / length : 0.0f;
+	if (vector[2] < 0.0f)
+	{
+		float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+	out[0] = QuantizeSnorm16(x);
+	out[1] = QuantizeSnorm16(y);
+}
+
+// Writes the value an absent stream is drawn with, encoded like "vertexFormat" stores that stream
+void EncodeStreamDefault(uint32_t vertexFormat, int stream, unsigned char* out)
+{
+	const float* value = GEOMETRY_STREAM_DEFAULTS[stream];
+	if (vertexFormat != GEOMETRY_VERTEX_FORMAT_QUANTIZED)
+	{
+		memcpy(out, value, GEOMETRY_STREAM_COMPONENTS[stream] * sizeof(float));
+		return;
+	}
+	if (stream == GEOMETRY_STREAM_POSITION)
+	{
+		uint16_t packed[4] = { 0, 0, 0, 65535 };
+		memcpy(out, packed, sizeof(packed));
+	}
+	else if (stream == GEOMETRY_STREAM_TEXCOORD)
+	{
+		uint16_t packed[2] = { FloatToHalf(value[0]), FloatToHalf(value[1]) };
+		memcpy(out, packed, sizeof(packed));
+	}
+	else
+	{
+		int16_t packed[2];
+		EncodeOctahedral(value, packed);
+		memcpy(out, packed, sizeof(packed));
+	}
+}
+
+// Position dequantization of a draw (scale & offset per axis), identity for float geometry
+void GetPositionDequantization(const SceneGeometry& geometry, size_t draw, float* scale, float* offset)
+{
+	for (int c = 0; c < 3; ++c)
+	{
+		bool quantized = geometry.vertexFormat == GEOMETRY_VERTEX_FORMAT_QUANTIZED;
+		scale[c] = quantized ? geometry.bounds[draw].max[c] - geometry.bounds[draw].min[c] : 1.0f;
+		offset[c] = quantized ? geometry.bounds[draw].min[c] : 0.0f;
+	}
+	scale[3] = 0.0f;
+	offset[3] = 0.0f;
+}
+
+// Converts float geometry (owned or mapped) into the compact format, replacing its streams with
+// owned storage. Every primitive is quantized against the bounds of the draws that use it.
+void QuantizeSceneGeometry(SceneGeometry& geometry)
+{
+	if (geometry.vertexFormat == GEOMETRY_VERTEX_FORMAT_QUANTIZED)
+		return;
+
+	// absent streams stay absent, their defaults are read in place of the missing data
+	uint32_t strides[GEOMETRY_STREAM_COUNT];
+	std::vector<unsigned char> quantized[GEOMETRY_STREAM_COUNT];
+	const float* streams[GEOMETRY_STREAM_COUNT];
+	uint32_t sourceStrides[GEOMETRY_STREAM_COUNT];
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		bool present = geometry.vertexStrides[i] != 0;
+		strides[i] = present ? QUANTIZED_STREAM_STRIDES[i] : 0;
+		quantized[i].assign(size_t(strides[i]) * geometry.vertexCount, 0);
+		streams[i] = present ? reinterpret_cast<const float*>(geometry.vertexStreams[i].data) : GEOMETRY_STREAM_DEFAULTS[i];
+		sourceStrides[i] = present ? GEOMETRY_STREAM_COMPONENTS[i] : 0;
+	}
+
+	// instances of a mesh share its vertices, only convert each range once
+	std::vector<bool> converted(geometry.vertexCount, false);
+	for (size_t d = 0; d < geometry.draws.size(); ++d)
+	{
+		const GeometryDraw& draw = geometry.draws[d];
+		if (draw.vertexCount == 0 || converted[draw.vertexOffset])
+			continue;
+
+		const GeometryBounds& bounds = geometry.bounds[d];
+		float scale[3], offset[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			scale[c] = bounds.max[c] - bounds.min[c];
+			offset[c] = bounds.min[c];
+		}
+		for (uint32_t v = draw.vertexOffset; v < draw.vertexOffset + draw.vertexCount; ++v)
+		{
+			converted[v] = true;
+			const float* position = streams[GEOMETRY_STREAM_POSITION] + size_t(v) * sourceStrides[GEOMETRY_STREAM_POSITION];
+			const float* tangent = streams[GEOMETRY_STREAM_TANGENT] + size_t(v) * sourceStrides[GEOMETRY_STREAM_TANGENT];
+			uint16_t packedPosition[4];
+			for (int c = 0; c < 3; ++c)
+				packedPosition[c] = QuantizeUnorm16(scale[c] > 0.0f ? (position[c] - offset[c]) / scale[c] : 0.0f);
+			packedPosition[3] = tangent[3] < 0.0f ? 0 : 65535;
+			memcpy(quantized[GEOMETRY_STREAM_POSITION].data() + size_t(v) * 8, packedPosition, 8);
+
+			int16_t packedNormal[2], packedTangent[2];
+			if (strides[GEOMETRY_STREAM_NORMAL] != 0)
+			{
+				EncodeOctahedral(streams[GEOMETRY_STREAM_NORMAL] + size_t(v) * 3, packedNormal);
+				memcpy(quantized[GEOMETRY_STREAM_NORMAL].data() + size_t(v) * 4, packedNormal, 4);
+			}
+			if (strides[GEOMETRY_STREAM_TANGENT] != 0)
+			{
+				EncodeOctahedral(tangent, packedTangent);
+				memcpy(quantized[GEOMETRY_STREAM_TANGENT].data() + size_t(v) * 4, packedTangent, 4);
+			}
+			if (strides[GEOMETRY_STREAM_TEXCOORD] != 0)
+			{
+				const float* texcoord = streams[GEOMETRY_STREAM_TEXCOORD] + size_t(v) * 2;
+				uint16_t packedTexcoord[2] = { FloatToHalf(texcoord[0]), FloatToHalf(texcoord[1]) };
+				memcpy(quantized[GEOMETRY_STREAM_TEXCOORD].data() + size_t(v) * 4, packedTexcoord, 4);
+			}
+		}
+	}
+
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+	{
+		geometry.streamStorage[i].swap(quantized[i]);
+		geometry.vertexStreams[i].data = geometry.streamStorage[i].data();
+		geometry.vertexStreams[i].size = geometry.streamStorage[i].size();
+		geometry.vertexStrides[i] = strides[i];
+	}
+	geometry.vertexFormat = GEOMETRY_VERTEX_FORMAT_QUANTIZED;
+}
+
+#endif
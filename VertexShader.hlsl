@@ -1,11 +1,15 @@
+// Float geometry fills the missing components with 0 (and w with 1), quantized geometry
+// (VertexQuantization.h) stores octahedral normal & tangent in xy and the tangent sign in Position.w
 struct OBJ_ATTRIBUTES
 {
-    float3 Position : POSITION;
+    float4 Position : POSITION;
     float3 Normal : NORMAL;
     float2 UV : TEXCOORD;
     float4 Tangent : TANGENT;
 };
 
+[[vk::constant_id(0)]] const int QUANTIZED_VERTICES = 0;
+
 struct SHADER_VARS
 {
     float4x4 viewMatrix;
@@ -20,6 +24,17 @@ cbuffer UboView : register(b0)
     SHADER_VARS ubo;
 }
 
+// glTF node to world matrix, position dequantization and base color factor, pushed per draw
+struct MESH_VARS
+{
+    float4x4 worldMatrix;
+    float4 dequantScale;
+    float4 dequantOffset;
+    float4 baseColorFactor;
+};
+
+[[vk::push_constant]] MESH_VARS mesh;
+
 struct VOut
 {
     float4 position : SV_POSITION;
@@ -29,18 +44,43 @@ struct VOut
     float4 tangent : TANGENT;
 };
 
+float3 DecodeOctahedral(float2 encoded)
+{
+    float3 vector = float3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    float fold = saturate(-vector.z);
+    vector.xy += float2(vector.x >= 0.0f ? -fold : fold, vector.y >= 0.0f ? -fold : fold);
+    return normalize(vector);
+}
+
+// Rows of the inverse-transpose of "m" up to a scale, so normals stay perpendicular under non-uniform
+// scale. The cofactors are scaled by det(m), its sign keeps mirrored nodes' normals facing out.
+float3x3 GetNormalMatrix(float3x3 m)
+{
+    float3x3 cofactors = float3x3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+    return dot(m[0], cofactors[0]) < 0.0f ? -cofactors : cofactors;
+}
+
 VOut main(OBJ_ATTRIBUTES input)
 {
     VOut output;
     
-    float4 worldPosition = float4(input.Position, 1.0f);
+    float3 position = input.Position.xyz * mesh.dequantScale.xyz + mesh.dequantOffset.xyz;
+    float3 normal = input.Normal;
+    float4 tangent = input.Tangent;
+    if (QUANTIZED_VERTICES != 0)
+    {
+        normal = DecodeOctahedral(input.Normal.xy);
+        tangent = float4(DecodeOctahedral(input.Tangent.xy), input.Position.w * 2.0f - 1.0f);
+    }
+    
+    float4 worldPosition = mul(mesh.worldMatrix, float4(position, 1.0f));
     float4 viewPosition = mul(ubo.viewMatrix, worldPosition);
     output.position = mul(ubo.projectionMatrix, viewPosition);
     
     output.worldPos = worldPosition.xyz;
-    output.normal = input.Normal;
+    output.normal = normalize(mul(GetNormalMatrix((float3x3)mesh.worldMatrix), normal));
     output.uv = input.UV;
-    output.tangent = input.Tangent;
+    output.tangent = float4(mul((float3x3)mesh.worldMatrix, tangent.xyz), tangent.w);
     
     return output;
 }
\ No newline at end of file
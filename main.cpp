@@ -17,7 +17,27 @@
 #define GATEWARE_ENABLE_MATH
 // With what we want & what we don't defined we can include the API
 #include "Gateware.h"
-#include "FileIntoString.h"	
+#include "MappedFile.h"
+#include "FileService.h"
+#include "GLTFJsonReader.h"
+#include "GLBLoader.h"
+#include "ContentHash.h"
+#include "ScratchArena.h"
+#include "MeshOptimizer.h"
+#include "SceneGeometry.h"
+#include "VertexQuantization.h"
+#include "VertexLayout.h"
+#include "GpuAllocator.h"
+#include "CacheFolder.h"
+#include "ShaderCache.h"
+#include "PipelineCache.h"
+#include "TextureCompression.h"
+#include "TextureLoader.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+#include "ImageCache.h"
+#include "TextureResidency.h"
+#include "AssetWatcher.h"
 #include "renderer.h"
 #include "Camera.h"
 // open some namespaces to compact the code a bit
@@ -26,9 +46,80 @@ using namespace CORE;
 using namespace SYSTEM;
 using namespace GRAPHICS;
 
+// Offline cook step: "<exe> --cook [--quantize] [--indices=source|repack|split] [--textures=none|bc7|bc1]
+// model.glb [model.gltf ...]" writes a .meshcache and a .ktx2 per sampled image next to each model
+int CookModels(int argc, char** argv)
+{
+	int failures = 0;
+	bool quantize = false;
+	INDEX_PACKING packing = INDEX_PACKING_REPACK;
+	TEXTURE_COMPRESSION compression = TEXTURE_COMPRESSION_BC7;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--quantize")
+		{
+			quantize = true;
+			continue;
+		}
+		if (arg.compare(0, 10, "--indices=") == 0)
+		{
+			if (!ParseIndexPacking(arg.substr(10), packing))
+				std::cout << "Unknown index packing \"" << arg.substr(10) << "\" (source, repack or split)" << std::endl;
+			continue;
+		}
+		if (arg.compare(0, 11, "--textures=") == 0)
+		{
+			if (!ParseTextureCompression(arg.substr(11), compression))
+				std::cout << "Unknown texture compression \"" << arg.substr(11) << "\" (none, bc7 or bc1)" << std::endl;
+			continue;
+		}
+		std::string err;
+		if (CookMeshCache(argv[i], quantize, packing, err))
+			std::cout << "Cooked \"" << argv[i] << "\" -> \"" << GetMeshCachePath(argv[i]) << "\"" << std::endl;
+		else
+		{
+			std::cout << "Failed to cook \"" << argv[i] << "\": " << err << std::endl;
+			++failures;
+			continue; // the textures would only fail to load the same model again
+		}
+		if (compression != TEXTURE_COMPRESSION_NONE && !CookTextureCache(argv[i], compression, err))
+		{
+			std::cout << "Failed to cook the textures of \"" << argv[i] << "\": " << err << std::endl;
+			++failures;
+		}
+	}
+	return failures;
+}
+
 // lets pop a window and use Vulkan to clear to a red screen
-int main()
+int main(int argc, char** argv)
 {
+	if (argc > 1 && std::string(argv[1]) == "--cook")
+		return CookModels(argc, argv);
+
+	RendererOptions options;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--quantize")
+			options.quantizeVertices = true;
+		else if (arg == "--benchmark")
+			options.benchmarkLayouts = true;
+		else if (arg == "--release-source")
+			options.releaseSourceData = true;
+		else if (arg == "--hot-reload")
+			options.hotReload = true;
+		else if (arg == "--decode-textures")
+			options.cookedTextures = false;
+		else if (arg.compare(0, 17, "--texture-budget=") == 0)
+			options.textureBudget = size_t(strtoul(arg.c_str() + 17, nullptr, 10)) << 20; // in MB
+		else if (arg.compare(0, 9, "--layout=") == 0 && !ParseVertexLayout(arg.substr(9), options.vertexLayout))
+			std::cout << "Unknown vertex layout \"" << arg.substr(9) << "\" (separate, interleaved or split)" << std::endl;
+		else if (arg.compare(0, 10, "--indices=") == 0 && !ParseIndexPacking(arg.substr(10), options.indexPacking))
+			std::cout << "Unknown index packing \"" << arg.substr(10) << "\" (source, repack or split)" << std::endl;
+	}
+
 	GWindow win;
 	GEventResponder msgs;
 	GVulkanSurface vulkan;
@@ -45,26 +136,36 @@ int main()
 			if (+e.Read(q) && q == GWindow::Events::RESIZE)
 				clrAndDepth[0].color.float32[2] += 0.01f; });
 		win.Register(msgs);
+		// all device features are enabled, sampling cooked textures needs textureCompressionBC
 #ifndef NDEBUG
 		const char *debugLayers[] = {
 			"VK_LAYER_KHRONOS_validation", // standard validation layer
 		};
 		if (+vulkan.Create(win, GW::GRAPHICS::DEPTH_BUFFER_SUPPORT,
 						   sizeof(debugLayers) / sizeof(debugLayers[0]),
-						   debugLayers, 0, nullptr, 0, nullptr, false))
+						   debugLayers, 0, nullptr, 0, nullptr, true))
 #else
-		if (+vulkan.Create(win, GW::GRAPHICS::DEPTH_BUFFER_SUPPORT))
+		if (+vulkan.Create(win, GW::GRAPHICS::DEPTH_BUFFER_SUPPORT, 0, nullptr, 0, nullptr, 0, nullptr, true))
 #endif
 		{
-			Renderer renderer(win, vulkan);
-			while (+win.ProcessWindowEvents())
+			try
 			{
-				if (+vulkan.StartFrame(2, clrAndDepth))
+				Renderer renderer(win, vulkan, options);
+				while (+win.ProcessWindowEvents())
 				{
-					renderer.Render();
-					vulkan.EndFrame(true);
+					if (+vulkan.StartFrame(2, clrAndDepth))
+					{
+						renderer.Render();
+						vulkan.EndFrame(true);
+					}
 				}
 			}
+			catch (const std::exception& e)
+			{
+				// the renderer joined its tasks on the way out, a failed startup just ends the program
+				std::cout << "Renderer failed: " << e.what() << std::endl;
+				return 1;
+			}
 		}
 	}
 	return 0; // that's all folks
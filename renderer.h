@@ -1,9 +1,17 @@
 // minimalistic code to draw a single triangle, this is not part of the API.
 #include "shaderc/shaderc.h" // needed for compiling shaders at runtime
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <thread>
 #ifdef _WIN32 // must use MT platform DLL libraries on windows
 #pragma comment(lib, "shaderc_combined.lib") 
 #endif
 #include "Camera.h"
+#ifndef M_PI // MSVC only defines it with _USE_MATH_DEFINES
+#define M_PI 3.14159265358979323846
+#endif
 void PrintLabeledDebugString(const char* label, const char* toPrint)
 {
 	std::cout << label << toPrint << std::endl;
@@ -15,6 +23,51 @@ void PrintLabeledDebugString(const char* label, const char* toPrint)
 #endif
 }
 
+// Startup choices made on the command line, see main()
+struct RendererOptions
+{
+	bool quantizeVertices = false; // upload the compact vertex format (VertexQuantization.h)
+	VERTEX_LAYOUT vertexLayout = VERTEX_LAYOUT_SEPARATE;
+	INDEX_PACKING indexPacking = INDEX_PACKING_REPACK;
+	bool benchmarkLayouts = false; // time every VERTEX_LAYOUT on the GPU, then continue with vertexLayout
+	bool releaseSourceData = false; // free the CPU copy of the model once it is uploaded (the layout can't change after)
+	bool hotReload = false; // reload the model whenever one of its files changes on disk
+	bool cookedTextures = true; // upload the block compressed textures of the cook step when the device samples them
+	size_t textureBudget = size_t(256) << 20; // bytes of texture levels kept on the GPU, mip tails may go over it
+};
+
+const unsigned int LAYOUT_BENCHMARK_FRAMES = 256; // frames timed per layout
+const unsigned int LAYOUT_BENCHMARK_WARMUP = 16; // leading frames left out of the average
+const float PLACEHOLDER_HALF_EXTENT = 0.1f; // size of the cube drawn until the model has streamed in
+const double ASSET_POLL_SECONDS = 0.5; // how often hot reload checks the model's files
+const uint32_t MATERIAL_IMAGE_COUNT = 1; // base color, the only image FragmentShader.hlsl samples
+const float DEFAULT_BASE_COLOR[4] = { 0.75f, 0.75f, 0.25f, 1.0f }; // draws without a material, the placeholder included
+const unsigned int TEXTURE_RESIDENCY_FRAMES = 8; // frames between texture residency updates
+const size_t TEXTURE_UPLOAD_LIMIT = size_t(16) << 20; // bytes of refined levels per residency upload
+
+// Where the model is on its way to the GPU, Render() advances it a step at a time
+enum MODEL_STREAM_STATE
+{
+	MODEL_STREAM_LOADING = 0, // parsed & decoded on the stream thread, which fans out onto the thread pool
+	MODEL_STREAM_PACKING, // written into its staging buffer on the stream thread
+	MODEL_STREAM_UPLOADING, // staging to device copy submitted, waiting on its fence
+	MODEL_STREAM_READY,
+	MODEL_STREAM_FAILED, // what was drawn before stays
+};
+
+// Everything one load of a model produces, a hot reload builds a new one next to the one being drawn
+struct ModelSource
+{
+	tinygltf::Model model;
+	std::vector<FileView> modelFiles; // back bufferSpans when the model's buffers were mapped
+	std::vector<BufferSpan> bufferSpans; // raw bytes of every glTF buffer, indexed like model.buffers
+	MappedFile meshCacheMapping; // backs geometry when it came from a cooked mesh cache
+	SceneGeometry geometry;
+	std::vector<DecodedImage> images; // indexed like model.images, only the ones materials sample are decoded, kept for residency
+	std::vector<int32_t> materialImages; // base color & metallic-roughness image of every material, -1 when unused
+	std::vector<std::string> files; // every file the geometry & images were read from
+};
+
 class Renderer
 {
 	// proxy handles
@@ -26,29 +79,27 @@ class Renderer
 	// what we need at a minimum to draw a triangle
 	VkDevice device = nullptr;
 	VkPhysicalDevice physicalDevice = nullptr;
+	GpuAllocator gpuAllocator; // every buffer & image the renderer creates is sub-allocated here
 
-	VkBuffer unifiedBufferHandle = nullptr;
-	VkDeviceMemory unifiedBufferData = nullptr;
 	VkShaderModule vertexShader = nullptr;
 	VkShaderModule fragmentShader = nullptr;
-	VkPipeline pipeline = nullptr;
+	std::map<std::string, VkPipeline> pipelines; // one per distinct vertex input state, keyed by its raw descriptions
 	VkPipelineLayout pipelineLayout = nullptr;
+	VkPipelineCache pipelineCache = nullptr; // seeded from and saved back to the cache folder
+	std::string pipelineCachePath;
 
 	unsigned int windowWidth, windowHeight;
 
-	VkBuffer geometryBuffer = nullptr;
-	VkDeviceMemory geometryBufferMemory = nullptr;
-	VkDeviceSize vertexBufferOffset = 0;
-	VkDeviceSize indexBufferOffset = 0;
-	uint32_t indexCount = 0;
-	VkIndexType indexType = VK_INDEX_TYPE_UINT16;
-	tinygltf::Model model; 
 	tinygltf::TinyGLTF loader;	
-	
+	std::string modelPath;
+	std::unique_ptr<ModelSource> source; // the model being drawn, null until it has streamed in
+	bool sourceReleased = false; // the model and geometry's pool are gone, only the draw metadata is left
+	AssetWatcher assetWatcher; // the files of source, polled when options.hotReload is set
+	std::chrono::steady_clock::time_point lastAssetPoll;
+	unsigned int modelLoads = 0; // swapped in so far, reloads included
+	RendererOptions options;
 
-	std::vector<VkDeviceSize> attributeOffsets;
-	std::vector<VkDeviceSize> attributeSizes;
-	VkDeviceSize totalBufferSize;
+	VERTEX_LAYOUT activeLayout = VERTEX_LAYOUT_SEPARATE;
 
 	// D3
 
@@ -64,38 +115,506 @@ class Renderer
 	GW::MATH::GMatrix math;
 	GW::MATH::GMATRIXF viewMatrix;
 	GW::MATH::GMATRIXF projectionMatrix;
-	std::vector<VkBuffer> uniformBuffers;
-	std::vector<VkDeviceMemory> uniformBuffersMemory;
+	// one persistently mapped ring holding a SHADER_VARS slot per frame in flight
+	VkBuffer uniformBuffer = nullptr;
+	GpuAllocation uniformBufferAllocation; // persistently mapped by the allocator
+	VkDeviceSize uniformSlotStride = 0; // sizeof(SHADER_VARS) rounded up to minUniformBufferOffsetAlignment
+	unsigned int uniformSlotCount = 0;
 
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorPool descriptorPool;
-	VkDescriptorSet descriptorSet;
-	std::vector<VkDescriptorSet> descriptorSets;
+	VkDescriptorSet descriptorSet; // selects its ring slot through a dynamic offset
+
+	// per draw push constants, matches MESH_VARS in both shaders
+	struct MESH_VARS
+	{
+		GeometryTransform worldMatrix;
+		float dequantScale[4];
+		float dequantOffset[4];
+		float baseColorFactor[4];
+	};
+
+	// Everything Render() needs to draw one geometry out of its device local buffer
+	struct GeometryBuffer
+	{
+		VkBuffer buffer = nullptr;
+		GpuAllocation allocation;
+		PackedVertexLayout layout;
+		std::vector<VkDeviceSize> bindingOffsets; // one per vertex binding inside the buffer
+		std::vector<VkDeviceSize> bindingSizes;
+		VkDeviceSize indexOffset = 0; // 16-bit section
+		VkDeviceSize wideIndexOffset = 0; // 32-bit section
+		VkDeviceSize size = 0;
+		std::vector<GeometryDraw> draws;
+		std::vector<MESH_VARS> drawConstants;
+		VkPipeline pipeline = nullptr; // owned by the pipelines map
+	};
+
+	// One sampled image holding the resident levels of its mip chain, from baseLevel down to 1x1
+	struct GpuTexture
+	{
+		VkImage image = nullptr;
+		GpuAllocation allocation;
+		VkImageView view = nullptr;
+		uint32_t width = 0; // of the image, which is baseLevel of the chain
+		uint32_t height = 0;
+		uint32_t mipLevels = 0;
+		uint32_t baseLevel = 0;
+	};
+
+	// The textures of a model and a descriptor set per material, streamed & retired along with its geometry
+	struct MaterialTextures
+	{
+		std::vector<GpuTexture> textures; // indexed like the model's images, unsampled ones stay empty
+		std::vector<VkDeviceSize> stagingOffsets; // where each texture's pixels follow the geometry in staging
+		std::vector<TextureResidency> residency; // indexed like textures
+		VkDescriptorPool pool = nullptr;
+		uint32_t materialCount = 0;
+		std::vector<VkDescriptorSet> materialSets; // materialCount per uniform slot, indexed like SceneGeometry::materials
+		uint32_t version = 0; // bumped whenever residency replaces a texture
+		std::vector<uint32_t> slotVersions; // version the sets of every uniform slot were written at
+	};
+
+	GeometryBuffer drawnBuffer; // the placeholder until the model has streamed in
+	MaterialTextures drawnTextures;
+	GeometryBuffer retiredBuffer; // the one drawnBuffer replaced, destroyed once no frame in flight reads it
+	MaterialTextures retiredTextures;
+	unsigned int retiredFrames = 0;
+
+	// set 1 of the pipeline layout: a sampler, then the MATERIAL_IMAGE_COUNT images of the draw's material
+	VkDescriptorSetLayout materialSetLayout = nullptr;
+	VkSampler textureSampler = nullptr; // linear & repeating, the glTF samplers are not read
+	bool textureCompression = false; // cooked BC1, BC5 & BC7 textures can be sampled, set before the model loads
+	GpuTexture defaultTexture; // 1x1 white, stands in for every image a material doesn't sample
+	VkDescriptorSet defaultMaterialSet = nullptr; // draws without a material, the placeholder included
+
+	// texture residency: drawnTextures start with their mip tails and are refined towards what the draws
+	// cover on screen, a batch of replacement textures at a time behind a fence
+	struct RetiredTexture
+	{
+		GpuTexture texture;
+		unsigned int frames; // until no frame in flight samples it
+	};
+	uint64_t residencyUpdates = 0;
+	unsigned int residencyFrames = 0; // since the last update
+	std::vector<GpuTexture> residencyTextures; // replacements being uploaded, indexed like drawnTextures.textures
+	VkCommandBuffer residencyCommandBuffer = nullptr;
+	VkFence residencyFence = nullptr;
+	VkBuffer residencyStagingBuffer = nullptr;
+	GpuAllocation residencyStagingAllocation;
+	std::vector<RetiredTexture> retiredMips; // replaced by residency
+
+	// the model is loaded & packed on streamThread and copied with a fenced submit while frames keep going
+	MODEL_STREAM_STATE streamState = MODEL_STREAM_LOADING;
+	std::atomic<bool> streamTaskDone{ false }; // raised by streamThread, Render() joins it on its next frame
+	std::string streamError;
+	std::unique_ptr<ModelSource> streamSource; // the load in progress, becomes source when it is swapped in
+	GeometryBuffer streamedBuffer; // becomes drawnBuffer once its copy has finished
+	MaterialTextures streamedTextures; // always new, textures are never copied in place
+	bool uploadInPlace = false; // streamedBuffer reuses drawnBuffer's buffer
+	std::vector<VkBufferCopy> uploadRegions; // parts of the staging buffer that are copied
+	VkBuffer streamStagingBuffer = nullptr;
+	GpuAllocation streamStagingAllocation;
+	VkCommandBuffer streamCommandBuffer = nullptr;
+	VkFence streamFence = nullptr;
+	std::chrono::steady_clock::time_point streamStart;
+	unsigned int streamFrames = 0; // presented while the stream was in progress
+
+	// layout benchmark, each layout writes a begin/end timestamp pair per frame into its own phase of the pool
+	VkQueryPool timestampPool = nullptr;
+	double timestampPeriod = 0; // nanoseconds per tick
+	int benchmarkLayout = -1; // layout being timed, -1 once the benchmark is done (or was never asked for)
+	unsigned int benchmarkFrame = 0;
+	double benchmarkResults[VERTEX_LAYOUT_COUNT] = {};
+
+	// CPU only startup work (shader compiles) runs on these while Vulkan objects are created
+	std::mutex startupErrorLock;
+	std::string startupError; // first failure of any startup task, rethrown once they are joined
+	std::vector<uint32_t> vertexShaderSpirv;
+	std::vector<uint32_t> fragmentShaderSpirv;
+	// reads the shader sources and compiles each from its completion callback. Declared after everything
+	// those write, so a throwing constructor joins them before that is destroyed.
+	FileService shaderReads;
+	// runs the stream's load & packing steps, last for the same reason: they write the stream members above
+	// and report through startupErrorLock. Not a pool job, the steps fan out onto the pool and wait for it,
+	// and a pool worker waiting on its own children ties up the pool (or deadlocks it with one worker).
+	std::thread streamThread;
 
 
 
 public:
-	Renderer(GW::SYSTEM::GWindow _win, GW::GRAPHICS::GVulkanSurface _vlk)
+	Renderer(GW::SYSTEM::GWindow _win, GW::GRAPHICS::GVulkanSurface _vlk, const RendererOptions& _options = RendererOptions())
 	{
 		win = _win;
 		vlk = _vlk;
+		options = _options;
+		activeLayout = options.vertexLayout;
 		math.Create();
-		LoadGLTFModel("../Models/blender_bebe.gltf");
-		
-		CreateViewMatrix();
-		CreateProjectionMatrix();
+		loader.SetImageLoader(KeepEncodedImage, nullptr); // images are decoded on the thread pool instead
+		CheckTextureCompression();
+		StartModelStream("../Models/Bebe.glb");
+		try
+		{
+			StartStartupTasks();
 
-		UpdateWindowDimensions();
-		InitializeGraphics();
-		BindShutdownCallback();
+			CreateViewMatrix();
+			CreateProjectionMatrix();
+
+			UpdateWindowDimensions();
+			InitializeGraphics();
+			BindShutdownCallback();
+		}
+		catch (...)
+		{
+			JoinStreamTask(); // a joinable std::thread must not be destroyed
+			throw;
+		}
+	}
+
+	~Renderer()
+	{
+		JoinStreamTask();
 	}
 
 private:
+	// Wraps "task" so a failure is recorded in "error" instead of escaping the thread that runs it.
+	// "done" (when given) is raised once the task is over either way.
+	std::function<void()> GuardTask(const char* name, std::function<void()> task, std::string& error,
+		std::atomic<bool>* done = nullptr)
+	{
+		return [this, name, task, &error, done]()
+		{
+			try
+			{
+				task();
+			}
+			catch (const std::exception& e)
+			{
+				std::lock_guard<std::mutex> guard(startupErrorLock);
+				if (error.empty())
+					error = std::string(name) + ": " + e.what();
+			}
+			if (done)
+				*done = true;
+		};
+	}
+
+	// Runs a step of the model stream on streamThread, the step before it must have been joined
+	void BranchStreamTask(const char* name, std::function<void()> task)
+	{
+		streamTaskDone = false;
+		std::function<void()> guarded = GuardTask(name, task, streamError, &streamTaskDone);
+		try
+		{
+			streamThread = std::thread(guarded);
+		}
+		catch (const std::system_error&)
+		{
+			guarded(); // no thread to be had, just do it now
+		}
+	}
+
+	void JoinStreamTask()
+	{
+		if (streamThread.joinable())
+			streamThread.join();
+	}
+
+	// Both shader compiles are independent of each other and of the GPU, each starts as soon as its source
+	// has been read
+	void StartStartupTasks()
+	{
+		std::vector<std::string> paths = { "../VertexShader.hlsl", "../FragmentShader.hlsl" };
+		shaderReads.ReadBatch(paths, [this](const FileRead& file) {
+			if (file.index == 0)
+			{
+				GuardTask("vertex shader", [this, &file]() {
+					vertexShaderSpirv = CompileShaderSpirv(file, shaderc_vertex_shader, "main.vert", "Vertex Shader Errors: \n");
+				}, startupError)();
+			}
+			else
+			{
+				GuardTask("fragment shader", [this, &file]() {
+					fragmentShaderSpirv = CompileShaderSpirv(file, shaderc_fragment_shader, "main.frag",
+						"Fragment Shader Errors: \n");
+				}, startupError)();
+			}
+		});
+	}
+
+	// Joins the startup tasks, from here on their results are only touched by this thread
+	void WaitForStartupTasks()
+	{
+		shaderReads.Wait();
+		if (!startupError.empty())
+			throw std::runtime_error("Startup failed in " + startupError);
+	}
+
+	// The model goes through MODEL_STREAM_STATE while frames are presented with the placeholder
+	void StartModelStream(const std::string& path)
+	{
+		modelPath = path;
+		assetWatcher.Watch(std::vector<std::string>(1, modelPath));
+		StartModelLoad();
+	}
+
+	// Loads into a new source, the one being drawn (if any) stays until the new one is swapped in
+	void StartModelLoad()
+	{
+		streamSource.reset(new ModelSource());
+		streamError.clear();
+		streamFrames = 0;
+		streamStart = std::chrono::steady_clock::now();
+		streamState = MODEL_STREAM_LOADING;
+		BranchStreamTask("model", [this]() { LoadModel(modelPath, *streamSource); });
+	}
+
+	// Moves the model a state further whenever the step it waits on has finished, never blocks the frame
+	void UpdateModelStream()
+	{
+		if (IsRetiring() && retiredFrames-- == 0)
+			DestroyRetired();
+
+		switch (streamState)
+		{
+		case MODEL_STREAM_LOADING:
+		case MODEL_STREAM_PACKING:
+			if (streamTaskDone)
+			{
+				JoinStreamTask(); // the step is over, this only joins it
+				if (!streamError.empty())
+					FailModelStream();
+				else if (streamState == MODEL_STREAM_LOADING)
+					BeginModelPacking();
+				else
+					SubmitModelUpload();
+			}
+			break;
+		case MODEL_STREAM_UPLOADING:
+			if (vkGetFenceStatus(device, streamFence) == VK_SUCCESS)
+			{
+				if (!uploadInPlace)
+					SwapInStreamedModel();
+				ReleaseModelUpload();
+				streamState = MODEL_STREAM_READY;
+			}
+			break;
+		default:
+			// the layout benchmark owns the buffers until it is done
+			if (options.hotReload && benchmarkLayout < 0)
+				PollModelFiles();
+			break;
+		}
+		if (streamState < MODEL_STREAM_READY)
+			++streamFrames;
+	}
+
+	// Reloads the model once one of its files was saved, the files are stat'ed every ASSET_POLL_SECONDS
+	void PollModelFiles()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (std::chrono::duration<double>(now - lastAssetPoll).count() < ASSET_POLL_SECONDS)
+			return;
+		lastAssetPoll = now;
+
+		std::string changedPath;
+		if (!assetWatcher.Poll(changedPath))
+			return;
+		std::cout << "\"" << changedPath << "\" changed, reloading \"" << modelPath << "\"" << std::endl;
+		StartModelLoad();
+	}
+
+	// The model is decoded: its buffers are created here, filling the staging one goes back to the stream thread
+	void BeginModelPacking()
+	{
+		PlanGeometryBuffer(streamSource->geometry, activeLayout, streamedBuffer);
+		// a reload of the drawn model that packs into the same places is copied into the buffer being drawn,
+		// ordered after the frames already submitted and before every frame recorded from then on. The
+		// placeholder, another model or a changed layout always get a buffer of their own.
+		uploadInPlace = source && !sourceReleased && IsSameGeometryShape(source->geometry, streamSource->geometry) &&
+			IsSameGeometryPlacement(drawnBuffer, streamedBuffer);
+		if (uploadInPlace)
+		{
+			streamedBuffer.buffer = drawnBuffer.buffer;
+			streamedBuffer.allocation = drawnBuffer.allocation;
+		}
+		else
+			CreateGeometryDeviceBuffer(streamedBuffer);
+		// the textures' pixels follow the geometry in the same staging buffer
+		VkDeviceSize stagingSize = CreateMaterialTextures(*streamSource, streamedBuffer.size, streamedTextures);
+		CreateStagingBuffer(stagingSize, &streamStagingBuffer, &streamStagingAllocation);
+
+		// only primitives that changed are copied, a new buffer is copied whole
+		const SceneGeometry* previous = uploadInPlace ? &source->geometry : nullptr;
+		streamState = MODEL_STREAM_PACKING;
+		BranchStreamTask("model packing", [this, previous]() {
+			FillGeometryStaging(streamSource->geometry, streamedBuffer, streamStagingAllocation.mapped);
+			FillTextureStaging(*streamSource, streamedTextures, streamStagingAllocation.mapped);
+			CollectUploadRegions(previous, streamSource->geometry, streamedBuffer, uploadRegions);
+		});
+	}
+
+	// Unlike signal_command_end nothing waits on the queue here, the following frames poll the fence
+	void SubmitModelUpload()
+	{
+		if (uploadRegions.empty() && streamedTextures.stagingOffsets.empty())
+		{
+			// nothing in the pool changed, the transforms & materials are pushed per draw anyway
+			SwapInStreamedModel();
+			ReleaseModelUpload();
+			streamState = MODEL_STREAM_READY;
+			return;
+		}
+
+		VkCommandPool commandPool;
+		VkQueue graphicsQueue;
+		vlk.GetCommandPool((void**)&commandPool);
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+
+		GvkHelper::signal_command_start(device, commandPool, &streamCommandBuffer);
+		if (!uploadRegions.empty())
+		{
+			if (uploadInPlace)
+			{
+				// the frames in flight must be done fetching from the buffer before it is overwritten
+				vkCmdPipelineBarrier(streamCommandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+					0, nullptr, 0, nullptr, 0, nullptr);
+			}
+			RecordGeometryCopy(streamCommandBuffer, streamStagingBuffer, streamedBuffer, uploadRegions);
+		}
+		// just the mip tails, texture residency refines them once the model is drawn
+		for (size_t i = 0; i < streamedTextures.textures.size(); ++i)
+		{
+			if (streamedTextures.textures[i].image)
+				RecordTextureUpload(streamCommandBuffer, streamStagingBuffer, streamedTextures.stagingOffsets[i],
+					streamSource->images[i], streamedTextures.textures[i]);
+		}
+		vkEndCommandBuffer(streamCommandBuffer);
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if (vkCreateFence(device, &fenceInfo, nullptr, &streamFence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create model upload fence");
+		}
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &streamCommandBuffer;
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, streamFence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit model upload");
+		}
+		streamState = MODEL_STREAM_UPLOADING;
+
+		// a new buffer waits for the fence, in place the frames recorded from now on already see the copy
+		if (uploadInPlace)
+			SwapInStreamedModel();
+	}
+
+	// The streamed model replaces the placeholder (or the model it reloads) from this frame on
+	void SwapInStreamedModel()
+	{
+		streamedBuffer.pipeline = GetGraphicsPipeline(streamSource->geometry.vertexFormat, streamedBuffer.layout);
+		if (residencyFence)
+		{
+			// the replacements belong to the textures about to retire, they retire along with them
+			vkWaitForFences(device, 1, &residencyFence, VK_TRUE, UINT64_MAX);
+			FinishResidencyUpload();
+		}
+		if (IsRetiring())
+		{
+			vkDeviceWaitIdle(device); // the last swap is still retiring, too rare to queue them up
+			DestroyRetired();
+		}
+		// frames still in flight may read the old buffer & textures, the uniform ring waits out the same frames
+		if (!uploadInPlace)
+			retiredBuffer = std::move(drawnBuffer);
+		retiredTextures = std::move(drawnTextures);
+		retiredFrames = uniformSlotCount;
+		drawnBuffer = std::move(streamedBuffer);
+		streamedBuffer = GeometryBuffer();
+		drawnTextures = std::move(streamedTextures);
+		streamedTextures = MaterialTextures();
+		source = std::move(streamSource);
+		sourceReleased = false;
+		assetWatcher.Watch(source->files);
+
+		VkDeviceSize uploaded = 0;
+		for (const VkBufferCopy& region : uploadRegions)
+			uploaded += region.size;
+		size_t textures = 0;
+		for (const GpuTexture& texture : drawnTextures.textures)
+			textures += texture.image != nullptr;
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - streamStart).count();
+		std::cout << "Model streamed in " << elapsed << " ms over " << streamFrames << " frames, " << uploaded
+			<< " bytes in " << uploadRegions.size() << " region(s)" << (uploadInPlace ? " copied in place" : "") << ", "
+			<< textures << " texture(s)" << std::endl;
+		PrintGeometryBuffer(source->geometry, drawnBuffer);
+		gpuAllocator.PrintStats();
+
+		if (options.benchmarkLayouts && ++modelLoads == 1)
+			StartLayoutBenchmark();
+		// the benchmark repacks the pool for every layout, it releases the source itself once done
+		if (options.releaseSourceData && benchmarkLayout < 0)
+			ReleaseSourceData();
+	}
+
+	void FailModelStream()
+	{
+		ReleaseModelUpload();
+		DiscardStreamedBuffer();
+		DestroyMaterialTextures(streamedTextures);
+		streamSource.reset();
+		streamState = MODEL_STREAM_FAILED;
+		std::cout << "Model streaming failed in " << streamError << (source ? ", keeping the current model" :
+			", keeping the placeholder") << std::endl;
+	}
+
+	bool IsRetiring() const
+	{
+		return retiredBuffer.buffer || retiredTextures.pool || !retiredTextures.textures.empty();
+	}
+
+	void DestroyRetired()
+	{
+		DestroyGeometryBuffer(retiredBuffer);
+		DestroyMaterialTextures(retiredTextures);
+	}
+
+	// In place uploads share drawnBuffer's buffer, it isn't streamedBuffer's to destroy
+	void DiscardStreamedBuffer()
+	{
+		if (!uploadInPlace)
+			DestroyGeometryBuffer(streamedBuffer);
+		streamedBuffer = GeometryBuffer();
+	}
+
+	// Staging buffer, command buffer & fence of the model upload
+	void ReleaseModelUpload()
+	{
+		if (streamCommandBuffer)
+		{
+			VkCommandPool commandPool;
+			vlk.GetCommandPool((void**)&commandPool);
+			vkFreeCommandBuffers(device, commandPool, 1, &streamCommandBuffer);
+			streamCommandBuffer = nullptr;
+		}
+		if (streamFence)
+		{
+			vkDestroyFence(device, streamFence, nullptr);
+			streamFence = nullptr;
+		}
+		if (streamStagingBuffer)
+			gpuAllocator.DestroyBuffer(streamStagingBuffer, streamStagingAllocation);
+	}
+
 	void CreateDescriptorSetLayout()
 	{
 		VkDescriptorSetLayoutBinding layoutBinding{};
 		layoutBinding.binding = 0;
-		layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 		layoutBinding.descriptorCount = 1;
 		layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
@@ -109,38 +628,82 @@ private:
 			throw std::runtime_error("Failed to create descriptor set layout!");
 		}
 	}
+	void CreateMaterialSetLayout()
+	{
+		VkDescriptorSetLayoutBinding bindings[1 + MATERIAL_IMAGE_COUNT] = {};
+		for (uint32_t i = 0; i < 1 + MATERIAL_IMAGE_COUNT; ++i)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_SAMPLER : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = 1 + MATERIAL_IMAGE_COUNT;
+		layoutInfo.pBindings = bindings;
+
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &materialSetLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create material descriptor set layout!");
+		}
+	}
+
+	// "views" holds the MATERIAL_IMAGE_COUNT images of the material, in binding order
+	void WriteMaterialSet(VkDescriptorSet set, const VkImageView* views)
+	{
+		VkDescriptorImageInfo imageInfos[1 + MATERIAL_IMAGE_COUNT] = {};
+		VkWriteDescriptorSet writes[1 + MATERIAL_IMAGE_COUNT] = {};
+		for (uint32_t i = 0; i < 1 + MATERIAL_IMAGE_COUNT; ++i)
+		{
+			if (i == 0)
+				imageInfos[i].sampler = textureSampler;
+			else
+			{
+				imageInfos[i].imageView = views[i - 1];
+				imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			}
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].dstSet = set;
+			writes[i].dstBinding = i;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_SAMPLER : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			writes[i].pImageInfo = &imageInfos[i];
+		}
+		vkUpdateDescriptorSets(device, 1 + MATERIAL_IMAGE_COUNT, writes, 0, nullptr);
+	}
+
 	// 2g self 
 	void CreateDescriptorSet()
 	{
-		unsigned int imageCount;
-		vlk.GetSwapchainImageCount(imageCount);
-		descriptorSets.resize(imageCount);
-
-		std::vector<VkDescriptorSetLayout> layouts(imageCount, descriptorSetLayout);
 		VkDescriptorSetAllocateInfo allocInfo{};
 		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 		allocInfo.descriptorPool = descriptorPool;
-		allocInfo.descriptorSetCount = imageCount;
-		allocInfo.pSetLayouts = layouts.data();
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &descriptorSetLayout;
 
-		if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+		if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to allocate descriptor sets!");
 		}
 	}
 	void CreateDescriptorPool()
 	{
-		unsigned int imageCount;
-		vlk.GetSwapchainImageCount(imageCount);
-		VkDescriptorPoolSize poolSize{};
-		poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSize.descriptorCount = imageCount;
+		// the uniform ring's set and the default material's, models bring a pool for their own materials
+		VkDescriptorPoolSize poolSizes[3] = {};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		poolSizes[0].descriptorCount = 1;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+		poolSizes[1].descriptorCount = 1;
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		poolSizes[2].descriptorCount = MATERIAL_IMAGE_COUNT;
 
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = 1;
-		poolInfo.pPoolSizes = &poolSize;
-		poolInfo.maxSets = imageCount;
+		poolInfo.poolSizeCount = 3;
+		poolInfo.pPoolSizes = poolSizes;
+		poolInfo.maxSets = 2;
 
 		if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
 		{
@@ -149,48 +712,44 @@ private:
 	}
 	void UpdateDescriptorSet()
 	{
-		unsigned int imageCount;
-		vlk.GetSwapchainImageCount(imageCount);
-		for (size_t i = 0; i < imageCount; i++)
-		{
-			VkDescriptorBufferInfo bufferInfo{};
-			bufferInfo.buffer = uniformBuffers[i];
-			bufferInfo.offset = 0;
-			bufferInfo.range = sizeof(SHADER_VARS);
-
-			VkWriteDescriptorSet descriptorWrite{};
-			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrite.dstSet = descriptorSets[i];
-			descriptorWrite.dstBinding = 0;
-			descriptorWrite.dstArrayElement = 0;
-			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptorWrite.descriptorCount = 1;
-			descriptorWrite.pBufferInfo = &bufferInfo;
-
-			vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
-		}
+		// points at slot 0, Render() picks the frame's slot with a dynamic offset
+		VkDescriptorBufferInfo bufferInfo{};
+		bufferInfo.buffer = uniformBuffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range = sizeof(SHADER_VARS);
+
+		VkWriteDescriptorSet descriptorWrite{};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = descriptorSet;
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pBufferInfo = &bufferInfo;
+
+		vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
 	}
 
 
 	void CreateUniformBuffers()
 	{
-		VkDeviceSize bufferSize = sizeof(SHADER_VARS);
-
 		unsigned int imageCount;
 		if (vlk.GetSwapchainImageCount(imageCount) != GW::GReturn::SUCCESS) {
 			throw std::runtime_error("Failed to get swapchain image count");
 		}
 
-		uniformBuffers.resize(imageCount);
-		uniformBuffersMemory.resize(imageCount);
+		// dynamic offsets must be multiples of the device's uniform alignment
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+		uniformSlotStride = (sizeof(SHADER_VARS) + alignment - 1) / alignment * alignment;
+		uniformSlotCount = imageCount;
 
-		for (size_t i = 0; i < imageCount; i++)
-		{
-			if (GvkHelper::create_buffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				&uniformBuffers[i], &uniformBuffersMemory[i]) != VK_SUCCESS) {
-				throw std::runtime_error("Failed to create uniform buffer");
-			}
+		// stays mapped for the lifetime of the renderer, coherent memory needs no flushes
+		if (gpuAllocator.CreateBuffer(uniformSlotStride * uniformSlotCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&uniformBuffer, &uniformBufferAllocation) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create uniform buffer");
 		}
 	}
 	void CreateViewMatrix()
@@ -206,9 +765,6 @@ private:
 
 	}
 
-#include <cmath>
-#include <corecrt_math_defines.h>
-#define _USE_MATH_DEFINES
 	void CreateProjectionMatrix() {
 		GW::MATH::GMATRIXF projectionMatrix;
 		float fov = 60.0f * (M_PI / 180.0f); //  degrees to radians
@@ -225,27 +781,25 @@ private:
 
 		this->projectionMatrix = projectionMatrix;
 	}
-	void UpdateUniformBuffer(uint32_t currentImage)
+	// Writes this frame's slot of the ring and returns its dynamic offset
+	uint32_t UpdateUniformBuffer(uint32_t currentImage)
 	{
 		SHADER_VARS shaderVars;
 
-		// memcpy(shaderVars.worldMatrix, worldMatrix, sizeof(worldMatrix));
-
 		shaderVars.viewMatrix = viewMatrix;
 		shaderVars.projectionMatrix = projectionMatrix;
 		shaderVars.sunDirection = { 0.0f, -0.8f, 0.0f, 0.0f }; // Example: light coming from above
 		shaderVars.sunColor = { 1.0f, 1.0f, 1.0f, 1.0f }; // White light
 		shaderVars.cameraPosition = { 0.0f, 0.0f, 0.0f, 1.0f }; // Example: camera at origin
 
-		void* data;
-		vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(shaderVars), 0, &data);
+		// the slot was last read by the frame that used this swapchain image, which has retired by now
+		VkDeviceSize offset = uniformSlotStride * (currentImage % uniformSlotCount);
+		memcpy(uniformBufferAllocation.mapped + offset, &shaderVars, sizeof(shaderVars));
+		return static_cast<uint32_t>(offset);
+	}
 
-		memcpy(data, &shaderVars, sizeof(shaderVars));
 
-		vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
 
-		GvkHelper::write_to_buffer(device, uniformBuffersMemory[currentImage], &shaderVars, sizeof(shaderVars));
-	}
 
 
 
@@ -261,15 +815,117 @@ private:
 
 
 
+	// Uses the cooked mesh cache when it is up to date, otherwise parses the glTF and re-cooks it
+	void LoadModel(const std::string& filepath, ModelSource& target)
+	{
+		std::string cachePath = GetMeshCachePath(filepath);
+		std::string err;
+		std::vector<ImageLocation> locations;
+		if (ReadMeshCache(cachePath, filepath, options.indexPacking, options.quantizeVertices, target.meshCacheMapping,
+			target.geometry, locations, err, &target.files))
+		{
+			std::cout << "Loaded mesh cache \"" << cachePath << "\" with " << target.geometry.draws.size() << " draws" << std::endl;
+			if (options.quantizeVertices)
+				QuantizeSceneGeometry(target.geometry); // no-op when it was cooked quantized
+			LoadModelImages(filepath, target, false, locations);
+			return;
+		}
+		std::cout << "Mesh cache \"" << cachePath << "\" unavailable (" << err << "), loading glTF" << std::endl;
+
+		LoadGLTFModel(filepath, target);
+		if (!BuildSceneGeometry(target.model, target.bufferSpans, target.geometry, err, options.indexPacking))
+		{
+			throw std::runtime_error("Failed to build scene geometry: " + err);
+		}
+		bool modelQuantized = ModelUsesMeshQuantization(target.model);
+		if (modelQuantized)
+			QuantizeSceneGeometry(target.geometry);
+
+		// a runtime --quantize is applied after the write, the cache keeps what the model defines
+		std::vector<MeshCacheDependency> dependencies;
+		GetImageLocations(target.model, target.bufferSpans, target.modelFiles, filepath, locations);
+		if (!CollectMeshCacheDependencies(filepath, target.model, dependencies, err) ||
+			!WriteMeshCache(cachePath, target.geometry, options.indexPacking, modelQuantized, dependencies, locations))
+		{
+			std::cout << "Mesh cache \"" << cachePath << "\" could not be written " << err << std::endl;
+		}
+		if (options.quantizeVertices)
+			QuantizeSceneGeometry(target.geometry); // no-op when the model is quantized already
+		std::string baseDir = filepath.substr(0, filepath.find_last_of("/\\") + 1);
+		for (const MeshCacheDependency& dependency : dependencies)
+			target.files.push_back(baseDir + dependency.path);
+		if (target.files.empty())
+			target.files.push_back(filepath);
+		LoadModelImages(filepath, target, true, locations);
+	}
 
+	// Reads the cooked textures the device can sample, maps the images decoded by an earlier run out of the
+	// image cache and decodes the rest of the images the materials sample on the thread pool. Without a
+	// parsed glTF the encoded images are mapped from the "locations" the mesh cache kept, the glTF is only
+	// parsed again when some image has none (a data URI).
+	void LoadModelImages(const std::string& filepath, ModelSource& target, bool parsed,
+		const std::vector<ImageLocation>& locations)
+	{
+		if (!GeometryUsesTextures(target.geometry))
+			return;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::vector<int> used;
+		CollectMaterialImages(locations.size(), target.geometry.materials, target.images, used);
+		std::string baseDir = filepath.substr(0, filepath.find_last_of("/\\") + 1);
+		std::vector<EncodedImage> encoded;
+		if (!parsed && AreImagesLocated(locations, used))
+			LocateEncodedImages(baseDir, locations, used, encoded);
+		else
+		{
+			if (!parsed)
+				LoadGLTFModel(filepath, target);
+			GetEncodedImages(target.model, target.bufferSpans, baseDir, used, encoded);
+		}
+		std::vector<int> uncooked = used;
+		if (textureCompression)
+			ReadTextureCaches(filepath, encoded, used, target.images, uncooked);
+		std::string cacheFolder = GetCacheSubFolder("images");
+		std::vector<int> remaining = uncooked;
+		std::vector<uint64_t> keys;
+		if (!cacheFolder.empty())
+			ReadImageCaches(cacheFolder, encoded, uncooked, target.images, remaining, keys);
+		std::string err;
+		if (!DecodeModelImages(encoded, remaining, target.images, err))
+		{
+			throw std::runtime_error("Failed to decode textures: " + err);
+		}
+		if (!cacheFolder.empty())
+		{
+			WriteImageCaches(cacheFolder, remaining, target.images, keys);
+			RemapImageCaches(cacheFolder, remaining, target.images, keys);
+			TrimImageCache(cacheFolder, uncooked, target.images, keys);
+		}
 
+		target.materialImages.resize(target.geometry.materials.size() * MATERIAL_IMAGE_COUNT);
+		for (size_t i = 0; i < target.geometry.materials.size(); ++i)
+		{
+			const GeometryMaterial& material = target.geometry.materials[i];
+			target.materialImages[i * MATERIAL_IMAGE_COUNT] = material.baseColorImage;
+		}
+		size_t loaded = 0;
+		for (int image : used)
+		{
+			loaded += target.images[image].GetLevelsSize();
+			if (image < static_cast<int>(locations.size()) && !locations[image].path.empty() && !locations[image].size)
+				target.files.push_back(baseDir + locations[image].path); // a saved texture reloads the model too
+		}
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Loaded " << used.size() - uncooked.size() << " cooked, " << uncooked.size() - remaining.size()
+			<< " cached & decoded " << remaining.size() << " image(s), " << loaded << " bytes in " << elapsed << " ms" << std::endl;
+	}
 
-	void LoadGLTFModel(const std::string& filepath)
+	void LoadGLTFModel(const std::string& filepath, ModelSource& target)
 	{
 		std::string err;
 		std::string warn;
 
-		bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, filepath);
+		bool ret = LoadModelFile(loader, filepath, target.model, target.modelFiles, target.bufferSpans, err, warn);
 
 		if (!warn.empty()) {
 			std::cout << "GLTF Warning: " << warn << std::endl;
@@ -283,23 +939,7 @@ private:
 			throw std::runtime_error("Failed to load GLTF model");
 		}
 
-		std::cout << "Loaded GLTF model with " << model.meshes.size() << " meshes" << std::endl;
-
-		const tinygltf::Mesh& mesh = model.meshes[0];
-		const tinygltf::Primitive& primitive = mesh.primitives[0]; // Assuming a single primitive
-
-		// Get the index accessor and its bufferView
-		const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
-		const tinygltf::BufferView& indexBufferView = model.bufferViews[indexAccessor.bufferView];
-		 indexBufferOffset = indexBufferView.byteOffset;
-
-		// Get the vertex accessor (for POSITION) and its bufferView
-		int positionAccessorIndex = primitive.attributes.find("POSITION")->second;
-		const tinygltf::Accessor& positionAccessor = model.accessors[positionAccessorIndex];
-		const tinygltf::BufferView& vertexBufferView = model.bufferViews[positionAccessor.bufferView];
-		 vertexBufferOffset = vertexBufferView.byteOffset;
-		  indexCount = indexAccessor.count;
-
+		std::cout << "Loaded GLTF model with " << target.model.meshes.size() << " meshes" << std::endl;
 	}
 
 
@@ -314,17 +954,47 @@ private:
 	void InitializeGraphics()
 	{
 		GetHandlesFromSurface();
-		InitializeVertexBuffer();
-		
-		
+
+		// nothing here depends on the model or the shaders
 		CreateUniformBuffers();
 		CreateDescriptorSetLayout();
+		CreateMaterialSetLayout();
 		CreateDescriptorPool();
 		CreateDescriptorSet();
 		UpdateDescriptorSet();
+		InitializeMaterials();
+		CreatePipelineCache();
 
-		CompileShaders();
-		InitializeGraphicsPipeline();
+		// only the shaders are waited for, the model keeps streaming in behind the placeholder
+		WaitForStartupTasks();
+		CreateShaderModules();
+		CreatePipelineLayout();
+		InitializePlaceholder();
+		gpuAllocator.PrintStats();
+	}
+
+	// Everything uploaded is dropped from system memory: the glTF (buffers & encoded images), its mappings
+	// and the geometry pool. The draw table, bounds, transforms and materials stay, and so do the decoded
+	// images, texture residency streams their levels in and out. Those are mapped from the image or texture
+	// cache whenever one could be written, so their pages are clean and the OS can drop them.
+	void ReleaseSourceData()
+	{
+		size_t released = source->meshCacheMapping.Size();
+		for (const FileView& file : source->modelFiles)
+			released += file->Size();
+		for (const tinygltf::Buffer& buffer : source->model.buffers)
+			released += buffer.data.size();
+		for (const tinygltf::Image& image : source->model.images)
+			released += image.image.size();
+		released += ReleaseGeometryPool(source->geometry);
+
+		source->model = tinygltf::Model();
+		std::vector<BufferSpan>().swap(source->bufferSpans);
+		source->modelFiles.clear();
+		source->meshCacheMapping.Close();
+		sourceReleased = true;
+		std::cout << "Released " << released << " bytes of CPU side model data, " << source->geometry.draws.size()
+			<< " draws kept" << std::endl;
 	}
 
 	void GetHandlesFromSurface()
@@ -332,139 +1002,657 @@ private:
 		vlk.GetDevice((void**)&device);
 		vlk.GetPhysicalDevice((void**)&physicalDevice);
 		vlk.GetRenderPass((void**)&renderPass);
+		gpuAllocator.Create(physicalDevice, device);
+	}
+
+	// A small cube is drawn until the model has streamed in, so frames are presented from the start
+	void InitializePlaceholder()
+	{
+		SceneGeometry placeholder;
+		BuildPlaceholderGeometry(placeholder, PLACEHOLDER_HALF_EXTENT);
+		UploadGeometryBuffer(placeholder, VERTEX_LAYOUT_SEPARATE, drawnBuffer);
+		drawnBuffer.pipeline = GetGraphicsPipeline(placeholder.vertexFormat, drawnBuffer.layout);
 	}
 
-	void InitializeVertexBuffer()
+	// Lays out the bindings & index sections of "source" and copies its draw table, touches no Vulkan state
+	void PlanGeometryBuffer(const SceneGeometry& source, VERTEX_LAYOUT layout, GeometryBuffer& target)
 	{
-		float verts[] =
+		target.layout = GetPackedVertexLayout(source, layout);
+		target.bindingOffsets.resize(target.layout.bindingCount);
+		target.bindingSizes.resize(target.layout.bindingCount);
+		target.size = 0;
+
+		// Calculate sizes and offsets for each binding (kept 4 byte aligned for the vertex fetch)
+		for (uint32_t i = 0; i < target.layout.bindingCount; ++i)
+		{
+			target.bindingSizes[i] = GetPackedBindingSize(source, target.layout, i);
+			target.bindingOffsets[i] = target.size;
+			target.size = (target.size + target.bindingSizes[i] + 3) & ~VkDeviceSize(3);
+		}
+
+		// Add index buffer size
+		target.indexOffset = target.size;
+		target.wideIndexOffset = target.indexOffset + GetWideIndexOffset(source);
+		target.size += source.indices.size;
+
+		target.draws = source.draws;
+		target.drawConstants.resize(source.draws.size());
+		for (size_t i = 0; i < source.draws.size(); ++i)
 		{
-			0,   0.5f,
-			0.5f, -0.5f,
-			-0.5f, -0.5f
+			MESH_VARS& constants = target.drawConstants[i];
+			constants.worldMatrix = source.transforms[i];
+			GetPositionDequantization(source, i, constants.dequantScale, constants.dequantOffset);
+
+			int32_t material = source.draws[i].material;
+			bool hasMaterial = material >= 0 && material < static_cast<int32_t>(source.materials.size());
+			for (int c = 0; c < 4; ++c)
+				constants.baseColorFactor[c] = hasMaterial ? source.materials[material].baseColorFactor[c] : DEFAULT_BASE_COLOR[c];
+		}
+	}
+
+	// Writes "source" into mapped staging memory laid out like "target", safe to run on the stream thread
+	void FillGeometryStaging(const SceneGeometry& source, const GeometryBuffer& target, unsigned char* staging)
+	{
+		for (uint32_t i = 0; i < target.layout.bindingCount; ++i)
+		{
+			PackVertexBinding(source, target.layout, i, staging + target.bindingOffsets[i]);
+		}
+		memcpy(staging + target.indexOffset, source.indices.data, source.indices.size);
+	}
+
+	// Everything is written once into a host visible staging buffer, geometry laid out exactly like the final one
+	void CreateStagingBuffer(VkDeviceSize size, VkBuffer* stagingBuffer, GpuAllocation* stagingAllocation)
+	{
+		if (gpuAllocator.CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			stagingBuffer, stagingAllocation) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create staging buffer");
+		}
+	}
+
+	// The GPU only ever reads geometry out of device local memory
+	void CreateGeometryDeviceBuffer(GeometryBuffer& target)
+	{
+		if (gpuAllocator.CreateBuffer(target.size,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &target.buffer, &target.allocation) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create device local geometry buffer");
+		}
+	}
+
+	// True when both buffers hold the pool at the same offsets with the same strides
+	bool IsSameGeometryPlacement(const GeometryBuffer& a, const GeometryBuffer& b)
+	{
+		if (a.size != b.size || a.indexOffset != b.indexOffset || a.wideIndexOffset != b.wideIndexOffset ||
+			a.bindingOffsets != b.bindingOffsets || a.layout.bindingCount != b.layout.bindingCount)
+			return false;
+		for (uint32_t i = 0; i < a.layout.bindingCount; ++i)
+		{
+			if (a.layout.bindingStrides[i] != b.layout.bindingStrides[i])
+				return false;
+		}
+		for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+		{
+			if (a.layout.streamBinding[i] != b.layout.streamBinding[i] || a.layout.streamOffset[i] != b.layout.streamOffset[i])
+				return false;
+		}
+		return true;
+	}
+
+	// Copy regions of a packed "target": all of it, or only the primitives that differ from "previous"
+	void CollectUploadRegions(const SceneGeometry* previous, const SceneGeometry& next, const GeometryBuffer& target,
+		std::vector<VkBufferCopy>& regions)
+	{
+		regions.clear();
+		if (!previous || !IsSameGeometryShape(*previous, next))
+		{
+			VkBufferCopy region = { 0, 0, target.size };
+			regions.push_back(region);
+			return;
+		}
+
+		std::vector<GeometryRange> vertices, narrowIndices, wideIndices;
+		CollectChangedGeometryRanges(*previous, next, vertices, narrowIndices, wideIndices);
+		auto addRanges = [&regions](const std::vector<GeometryRange>& ranges, VkDeviceSize base, VkDeviceSize stride)
+		{
+			for (const GeometryRange& range : ranges)
+			{
+				VkBufferCopy region = { base + range.first * stride, base + range.first * stride, (range.end - range.first) * stride };
+				regions.push_back(region);
+			}
 		};
+		for (uint32_t i = 0; i < target.layout.bindingCount; ++i)
+		{
+			if (target.layout.bindingStrides[i] != 0) // the defaults binding never changes
+				addRanges(vertices, target.bindingOffsets[i], target.layout.bindingStrides[i]);
+		}
+		addRanges(narrowIndices, target.indexOffset, sizeof(uint16_t));
+		addRanges(wideIndices, target.wideIndexOffset, sizeof(uint32_t));
+	}
 
-		CreateUnifiedBuffer();
+	// The staging buffer is laid out like the target, so every region has the same source & destination offset.
+	// The barrier hands the copy to the vertex & index fetch of anything submitted after it.
+	void RecordGeometryCopy(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, const GeometryBuffer& target,
+		const std::vector<VkBufferCopy>& regions)
+	{
+		vkCmdCopyBuffer(commandBuffer, stagingBuffer, target.buffer, static_cast<uint32_t>(regions.size()), regions.data());
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = target.buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+			0, nullptr, 1, &barrier, 0, nullptr);
 	}
 
-	void CreateUnifiedBuffer()
+	// Blocking upload for the placeholder and layout switches, the model streams in through UpdateModelStream()
+	void UploadGeometryBuffer(const SceneGeometry& source, VERTEX_LAYOUT layout, GeometryBuffer& target)
 	{
-		const tinygltf::Mesh& mesh = model.meshes[0];
-		const tinygltf::Primitive& primitive = mesh.primitives[0];
+		PlanGeometryBuffer(source, layout, target);
+		VkBuffer stagingBuffer = nullptr;
+		GpuAllocation stagingAllocation;
+		CreateGeometryDeviceBuffer(target);
+		CreateStagingBuffer(target.size, &stagingBuffer, &stagingAllocation);
+		FillGeometryStaging(source, target, stagingAllocation.mapped);
+		std::vector<VkBufferCopy> regions(1);
+		regions[0].size = target.size;
+
+		VkCommandPool commandPool;
+		VkQueue graphicsQueue;
+		vlk.GetCommandPool((void**)&commandPool);
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+
+		VkCommandBuffer commandBuffer;
+		GvkHelper::signal_command_start(device, commandPool, &commandBuffer);
+		RecordGeometryCopy(commandBuffer, stagingBuffer, target, regions);
+		GvkHelper::signal_command_end(device, graphicsQueue, commandPool, &commandBuffer); // waits for the copy
+
+		gpuAllocator.DestroyBuffer(stagingBuffer, stagingAllocation);
+	}
 
-		attributeOffsets.resize(4);
-		attributeSizes.resize(4);
-		totalBufferSize = 0;
+	void DestroyGeometryBuffer(GeometryBuffer& target)
+	{
+		if (target.buffer)
+			gpuAllocator.DestroyBuffer(target.buffer, target.allocation);
+		target = GeometryBuffer();
+	}
 
-		// Calculate sizes and offsets for each attribute
-		for (int i = 0; i < 4; ++i)
+	void PrintGeometryBuffer(const SceneGeometry& source, const GeometryBuffer& target)
+	{
+		std::cout << "Total buffer size: " << target.size << " (" << VERTEX_LAYOUT_NAMES[activeLayout] << " layout)" << std::endl;
+		for (uint32_t i = 0; i < target.layout.bindingCount; ++i)
 		{
-			const tinygltf::Accessor& accessor = model.accessors[i];
-			const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-			attributeSizes[i] = bufferView.byteLength;
-			attributeOffsets[i] = totalBufferSize;
-			totalBufferSize += attributeSizes[i];
+			std::cout << "Binding " << i << " - Offset: " << target.bindingOffsets[i]
+				<< ", Size: " << target.bindingSizes[i] << ", Stride: " << target.layout.bindingStrides[i] << std::endl;
 		}
+		std::cout << "Index buffer - Offset: " << target.indexOffset
+			<< ", Size: " << source.indices.size << " (" << source.narrowIndexCount << " 16-bit, "
+			<< source.indexCount - source.narrowIndexCount << " 32-bit)" << std::endl;
+		std::cout << "Draw table - " << source.draws.size() << " draws, "
+			<< source.vertexCount << " vertices" << (source.vertexFormat == GEOMETRY_VERTEX_FORMAT_QUANTIZED ?
+				" (quantized)" : "") << std::endl;
+	}
+	// Cooked textures are only read when the device was created with textureCompressionBC and can filter
+	// every format the cook step writes, otherwise the images are decoded like any other
+	void CheckTextureCompression()
+	{
+		if (!options.cookedTextures)
+			return;
+		vlk.GetPhysicalDevice((void**)&physicalDevice);
+		VkPhysicalDeviceFeatures features;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+		textureCompression = features.textureCompressionBC == VK_TRUE;
 
-		// Add index buffer size
-		const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
-		const tinygltf::BufferView& indexBufferView = model.bufferViews[indexAccessor.bufferView];
-		VkDeviceSize indexBufferSize = indexBufferView.byteLength;
-		indexBufferOffset = totalBufferSize;
-		totalBufferSize += indexBufferSize;
-
-		// Create unified buffer
-		GvkHelper::create_buffer(physicalDevice, device, totalBufferSize,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&unifiedBufferHandle, &unifiedBufferData);
+		const VkFormat formats[] = { VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC1_RGB_SRGB_BLOCK, VK_FORMAT_BC5_UNORM_BLOCK,
+			VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK };
+		for (VkFormat format : formats)
+		{
+			VkFormatProperties properties;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+			if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+				textureCompression = false;
+		}
+		if (!textureCompression)
+			std::cout << "Block compressed textures are unsupported, images will be decoded" << std::endl;
+	}
 
-		// Copy vertex data
-		for (int i = 0; i < 4; ++i)
+	void InitializeMaterials()
+	{
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+		if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
 		{
-			const tinygltf::Accessor& accessor = model.accessors[i];
-			const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-			const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+			throw std::runtime_error("Failed to create texture sampler");
+		}
 
-			void* data;
-			vkMapMemory(device, unifiedBufferData, attributeOffsets[i], attributeSizes[i], 0, &data);
-			memcpy(data, &buffer.data[bufferView.byteOffset], attributeSizes[i]);
-			vkUnmapMemory(device, unifiedBufferData);
+		// the white texture is tiny, a blocking upload is fine for it
+		VkBuffer stagingBuffer = nullptr;
+		GpuAllocation stagingAllocation;
+		CreateTexture(1, 1, VK_FORMAT_R8G8B8A8_UNORM, 1, defaultTexture);
+		CreateStagingBuffer(4, &stagingBuffer, &stagingAllocation);
+		memset(stagingAllocation.mapped, 0xff, 4);
+
+		VkCommandPool commandPool;
+		VkQueue graphicsQueue;
+		vlk.GetCommandPool((void**)&commandPool);
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+
+		VkCommandBuffer commandBuffer;
+		GvkHelper::signal_command_start(device, commandPool, &commandBuffer);
+		DecodedImage white; // describes the staged texel
+		white.width = white.height = 1;
+		white.format = TEXTURE_FORMAT_RGBA8;
+		white.levelOffsets.assign(1, 0);
+		RecordTextureUpload(commandBuffer, stagingBuffer, 0, white, defaultTexture);
+		GvkHelper::signal_command_end(device, graphicsQueue, commandPool, &commandBuffer); // waits for the copy
+		gpuAllocator.DestroyBuffer(stagingBuffer, stagingAllocation);
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &materialSetLayout;
+		if (vkAllocateDescriptorSets(device, &allocInfo, &defaultMaterialSet) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate the default material set");
 		}
+		VkImageView views[MATERIAL_IMAGE_COUNT];
+		for (uint32_t i = 0; i < MATERIAL_IMAGE_COUNT; ++i)
+			views[i] = defaultTexture.view;
+		WriteMaterialSet(defaultMaterialSet, views);
+	}
 
-		// Copy index data
-		void* data;
-		vkMapMemory(device, unifiedBufferData, indexBufferOffset, indexBufferSize, 0, &data);
-		memcpy(data, &model.buffers[indexBufferView.buffer].data[indexBufferView.byteOffset], indexBufferSize);
-		vkUnmapMemory(device, unifiedBufferData);
+	// Image with room for "mipLevels" levels, filled by RecordTextureUpload
+	VkImageCreateInfo GetTextureImageInfo(uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels)
+	{
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = format;
+		imageInfo.extent = { width, height, 1 };
+		imageInfo.mipLevels = mipLevels;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		return imageInfo;
+	}
 
-		indexCount = indexAccessor.count;
+	void CreateTexture(uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels, GpuTexture& texture)
+	{
+		texture.width = width;
+		texture.height = height;
+		texture.mipLevels = mipLevels;
 
+		VkImageCreateInfo imageInfo = GetTextureImageInfo(width, height, format, mipLevels);
+		if (gpuAllocator.CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texture.image, &texture.allocation) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create texture image");
+		}
 
-		std::cout << "Total buffer size: " << totalBufferSize << std::endl;
-		for (int i = 0; i < 4; ++i)
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = texture.image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = imageInfo.format;
+		if (format == VK_FORMAT_BC5_UNORM_BLOCK) // the cook step moved roughness & metallic into red & green
+			viewInfo.components = { VK_COMPONENT_SWIZZLE_ONE, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_ONE };
+		viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mipLevels, 0, 1 };
+		if (vkCreateImageView(device, &viewInfo, nullptr, &texture.view) != VK_SUCCESS)
 		{
-			std::cout << "Attribute " << i << " - Offset: " << attributeOffsets[i]
-				<< ", Size: " << attributeSizes[i] << std::endl;
+			throw std::runtime_error("Failed to create texture view");
 		}
-		std::cout << "Index buffer - Offset: " << indexBufferOffset
-			<< ", Size: " << indexBufferSize << std::endl;
 	}
-	//void CreateUnifiedBuffer()
-	//{
-	//	const tinygltf::Mesh& mesh = model.meshes[0];
-	//	const tinygltf::Primitive& primitive = mesh.primitives[0];
 
-	//	const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
-	//	const tinygltf::BufferView& indexBufferView = model.bufferViews[indexAccessor.bufferView];
-	//	const tinygltf::Buffer& indexBuffer = model.buffers[indexBufferView.buffer];
+	// Texture of "image" holding the levels from "baseLevel" on
+	void CreateImageTexture(const DecodedImage& image, uint32_t baseLevel, GpuTexture& texture)
+	{
+		CreateTexture(std::max(image.width >> baseLevel, 1u), std::max(image.height >> baseLevel, 1u),
+			static_cast<VkFormat>(image.format), static_cast<uint32_t>(image.levelOffsets.size()) - baseLevel, texture);
+		texture.baseLevel = baseLevel;
+	}
 
-	//	int positionAccessorIndex = primitive.attributes.find("POSITION")->second;
-	//	const tinygltf::Accessor& positionAccessor = model.accessors[positionAccessorIndex];
-	//	const tinygltf::BufferView& positionBufferView = model.bufferViews[positionAccessor.bufferView];
-	//	const tinygltf::Buffer& positionBuffer = model.buffers[positionBufferView.buffer];
+	// Fills residency.allocationSizes with what the allocator hands out for a texture of "image" starting at
+	// every level down to the tail. The images are only created to ask for their memory requirements.
+	void GetTextureAllocationSizes(const DecodedImage& image, TextureResidency& residency)
+	{
+		residency.allocationSizes.assign(residency.tailLevel + 1, 0);
+		for (uint32_t level = 0; level <= residency.tailLevel; ++level)
+		{
+			VkImageCreateInfo imageInfo = GetTextureImageInfo(std::max(image.width >> level, 1u),
+				std::max(image.height >> level, 1u), static_cast<VkFormat>(image.format), residency.levelCount - level);
+			VkImage probe = nullptr;
+			if (vkCreateImage(device, &imageInfo, nullptr, &probe) != VK_SUCCESS)
+				continue; // left 0, the levels' own size stands in
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(device, probe, &requirements);
+			vkDestroyImage(device, probe, nullptr);
+			residency.allocationSizes[level] = gpuAllocator.GetAllocationSize(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		}
+	}
 
-	//	VkDeviceSize indexBufferSize = indexAccessor.count * sizeof(uint16_t);
-	//	VkDeviceSize vertexBufferSize = positionAccessor.count * 3 * sizeof(float);
+	// Bytes the resident levels of "texture" take in staging, where they are packed baseLevel first
+	VkDeviceSize GetTextureStagingSize(const DecodedImage& image, const GpuTexture& texture)
+	{
+		VkDeviceSize size = 0;
+		for (size_t level = texture.baseLevel; level < image.levelOffsets.size(); ++level)
+			size += image.GetLevelSize(level);
+		return size;
+	}
 
-	//	// Ensure index buffer size is aligned to 4 bytes
-	//	VkDeviceSize alignedIndexBufferSize = (indexBufferSize + 3) & ~3;
+	// Packs the resident levels of "texture" into "staging", wherever "image" keeps them
+	void CopyTextureStaging(const DecodedImage& image, const GpuTexture& texture, unsigned char* staging)
+	{
+		for (size_t level = texture.baseLevel; level < image.levelOffsets.size(); ++level)
+		{
+			memcpy(staging, image.GetLevels() + image.levelOffsets[level], image.GetLevelSize(level));
+			staging += image.GetLevelSize(level);
+		}
+	}
 
-	//	VkDeviceSize totalBufferSize = alignedIndexBufferSize + vertexBufferSize;
+	// Creates a texture per decoded image of "model" holding just its mip tail, and the descriptor sets of every
+	// material. The pixels are placed after the "geometrySize" bytes of geometry in staging, returns the size
+	// the staging buffer needs.
+	VkDeviceSize CreateMaterialTextures(const ModelSource& model, VkDeviceSize geometrySize, MaterialTextures& target)
+	{
+		VkDeviceSize stagingSize = geometrySize;
+		target.textures.resize(model.images.size());
+		target.stagingOffsets.resize(model.images.size());
+		target.residency.resize(model.images.size());
+		for (size_t i = 0; i < model.images.size(); ++i)
+		{
+			const DecodedImage& image = model.images[i];
+			if (image.width == 0)
+				continue;
+			TextureResidency& residency = target.residency[i];
+			InitializeTextureResidency(image.format, image.width, image.height, static_cast<uint32_t>(image.levelOffsets.size()),
+				residency);
+			GetTextureAllocationSizes(image, residency);
+			CreateImageTexture(image, residency.residentLevel, target.textures[i]);
+			stagingSize = (stagingSize + 15) & ~VkDeviceSize(15); // buffer to image copies start on a texel block
+			target.stagingOffsets[i] = stagingSize;
+			stagingSize += GetTextureStagingSize(image, target.textures[i]);
+		}
 
-	//	// Create unified buffer
-	//	GvkHelper::create_buffer(physicalDevice, device, totalBufferSize,
-	//		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-	//		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-	//		&unifiedBufferHandle, &unifiedBufferData);
+		target.materialCount = static_cast<uint32_t>(model.geometry.materials.size());
+		if (target.materialCount == 0)
+			return stagingSize;
+		// a set per uniform slot, so residency can swap a view without touching the sets of frames in flight
+		uint32_t setCount = target.materialCount * uniformSlotCount;
+		VkDescriptorPoolSize poolSizes[2] = {};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+		poolSizes[0].descriptorCount = setCount;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		poolSizes[1].descriptorCount = setCount * MATERIAL_IMAGE_COUNT;
 
-	//	// Copy index data
-	//	void* data;
-	//	vkMapMemory(device, unifiedBufferData, 0, alignedIndexBufferSize, 0, &data);
-	//	memcpy(data, &indexBuffer.data[indexBufferView.byteOffset], indexBufferSize);
-	//	vkUnmapMemory(device, unifiedBufferData);
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = 2;
+		poolInfo.pPoolSizes = poolSizes;
+		poolInfo.maxSets = setCount;
+		if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &target.pool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create material descriptor pool");
+		}
 
-	//	// Copy vertex data
-	//	vkMapMemory(device, unifiedBufferData, alignedIndexBufferSize, vertexBufferSize, 0, &data);
-	//	memcpy(data, &positionBuffer.data[positionBufferView.byteOffset], vertexBufferSize);
-	//	vkUnmapMemory(device, unifiedBufferData);
+		std::vector<VkDescriptorSetLayout> layouts(setCount, materialSetLayout);
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = target.pool;
+		allocInfo.descriptorSetCount = setCount;
+		allocInfo.pSetLayouts = layouts.data();
+		target.materialSets.resize(setCount);
+		if (vkAllocateDescriptorSets(device, &allocInfo, target.materialSets.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate material descriptor sets");
+		}
 
-	//	indexBufferOffset = 0;
-	//	vertexBufferOffset = alignedIndexBufferSize;
-	//	indexCount = indexAccessor.count;
-	//}
+		// the views are written now, the images are in the layout the sets name by the time a frame samples them
+		target.slotVersions.assign(uniformSlotCount, target.version);
+		for (uint32_t slot = 0; slot < uniformSlotCount; ++slot)
+			WriteMaterialSets(model.materialImages, target, slot);
+		return stagingSize;
+	}
 
-	void CompileShaders()
+	// Points the sets of uniform slot "slot" at the current textures, the slot's last frame must be done with them
+	void WriteMaterialSets(const std::vector<int32_t>& materialImages, MaterialTextures& target, uint32_t slot)
 	{
-		// Intialize runtime shader compiler HLSL -> SPIRV
-		shaderc_compiler_t compiler = shaderc_compiler_initialize();
-		shaderc_compile_options_t options = CreateCompileOptions();
+		for (uint32_t i = 0; i < target.materialCount; ++i)
+		{
+			VkImageView views[MATERIAL_IMAGE_COUNT];
+			for (uint32_t j = 0; j < MATERIAL_IMAGE_COUNT; ++j)
+			{
+				int32_t image = materialImages.empty() ? -1 : materialImages[i * MATERIAL_IMAGE_COUNT + j];
+				views[j] = image >= 0 && target.textures[image].view ? target.textures[image].view : defaultTexture.view;
+			}
+			WriteMaterialSet(target.materialSets[slot * target.materialCount + i], views);
+		}
+		target.slotVersions[slot] = target.version;
+	}
 
-		CompileVertexShader(compiler, options);
-		CompileFragmentShader(compiler, options);
+	// Copies the resident levels of every texture to its staging offset, safe to run on the stream thread
+	void FillTextureStaging(const ModelSource& model, const MaterialTextures& target, unsigned char* staging)
+	{
+		for (size_t i = 0; i < target.textures.size(); ++i)
+		{
+			if (target.textures[i].image)
+				CopyTextureStaging(model.images[i], target.textures[i], staging + target.stagingOffsets[i]);
+		}
+	}
 
-		// Free runtime shader compiler resources
-		shaderc_compile_options_release(options);
-		shaderc_compiler_release(compiler);
+	// Copies every level of "texture" out of staging, where CopyTextureStaging packed the levels of "image"
+	// from "stagingOffset" on. Every level ends up shader readable for the fragment shaders of anything
+	// submitted after it.
+	void RecordTextureUpload(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkDeviceSize stagingOffset,
+		const DecodedImage& image, const GpuTexture& texture)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = texture.image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mipLevels, 0, 1 };
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+
+		std::vector<VkBufferImageCopy> copies(texture.mipLevels);
+		for (uint32_t level = 0; level < texture.mipLevels; ++level)
+		{
+			copies[level].bufferOffset = stagingOffset;
+			stagingOffset += image.GetLevelSize(texture.baseLevel + level);
+			copies[level].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+			copies[level].imageExtent = { std::max(texture.width >> level, 1u), std::max(texture.height >> level, 1u), 1 };
+		}
+		vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			texture.mipLevels, copies.data());
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	void DestroyTexture(GpuTexture& texture)
+	{
+		if (texture.view)
+			vkDestroyImageView(device, texture.view, nullptr);
+		if (texture.image)
+			gpuAllocator.DestroyImage(texture.image, texture.allocation);
+		texture = GpuTexture();
+	}
+
+	// The pool takes the material sets with it
+	void DestroyMaterialTextures(MaterialTextures& target)
+	{
+		for (GpuTexture& texture : target.textures)
+			DestroyTexture(texture);
+		if (target.pool)
+			vkDestroyDescriptorPool(device, target.pool, nullptr);
+		target = MaterialTextures();
+	}
+
+	// Every TEXTURE_RESIDENCY_FRAMES frames the levels the drawn textures need are worked out from the camera,
+	// the textures that should change get replacements holding their new levels. Those are uploaded behind a
+	// fence and swapped in once it signals, the textures they replace retire like a swapped out model.
+	void UpdateTextureResidency()
+	{
+		for (size_t i = 0; i < retiredMips.size();)
+		{
+			if (retiredMips[i].frames-- == 0)
+			{
+				DestroyTexture(retiredMips[i].texture);
+				retiredMips[i] = retiredMips.back();
+				retiredMips.pop_back();
+			}
+			else
+				++i;
+		}
+
+		if (residencyFence)
+		{
+			if (vkGetFenceStatus(device, residencyFence) == VK_SUCCESS)
+				FinishResidencyUpload();
+			return;
+		}
+		if (!source || drawnTextures.residency.empty() || ++residencyFrames < TEXTURE_RESIDENCY_FRAMES)
+			return;
+		residencyFrames = 0;
+		StartResidencyUpload();
+	}
+
+	void StartResidencyUpload()
+	{
+		std::vector<TextureResidency>& residency = drawnTextures.residency;
+		UpdateWantedTextureLevels(source->geometry, source->materialImages, MATERIAL_IMAGE_COUNT, viewMatrix.data,
+			projectionMatrix.data[5], windowHeight, ++residencyUpdates, residency);
+		std::vector<uint32_t> targetLevels;
+		PlanTextureResidency(residency, options.textureBudget, TEXTURE_UPLOAD_LIMIT, targetLevels);
+
+		residencyTextures.assign(residency.size(), GpuTexture());
+		std::vector<VkDeviceSize> stagingOffsets(residency.size());
+		VkDeviceSize stagingSize = 0;
+		for (size_t i = 0; i < residency.size(); ++i)
+		{
+			if (residency[i].levelCount == 0 || targetLevels[i] == residency[i].residentLevel)
+				continue;
+			CreateImageTexture(source->images[i], targetLevels[i], residencyTextures[i]);
+			stagingSize = (stagingSize + 15) & ~VkDeviceSize(15);
+			stagingOffsets[i] = stagingSize;
+			stagingSize += GetTextureStagingSize(source->images[i], residencyTextures[i]);
+		}
+		if (stagingSize == 0)
+		{
+			residencyTextures.clear();
+			return;
+		}
+		CreateStagingBuffer(stagingSize, &residencyStagingBuffer, &residencyStagingAllocation);
+
+		VkCommandPool commandPool;
+		VkQueue graphicsQueue;
+		vlk.GetCommandPool((void**)&commandPool);
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+
+		// the levels are decoded already, a copy per replacement is all this frame adds
+		GvkHelper::signal_command_start(device, commandPool, &residencyCommandBuffer);
+		for (size_t i = 0; i < residencyTextures.size(); ++i)
+		{
+			const GpuTexture& texture = residencyTextures[i];
+			if (!texture.image)
+				continue;
+			const DecodedImage& image = source->images[i];
+			CopyTextureStaging(image, texture, residencyStagingAllocation.mapped + stagingOffsets[i]);
+			RecordTextureUpload(residencyCommandBuffer, residencyStagingBuffer, stagingOffsets[i], image, texture);
+		}
+		vkEndCommandBuffer(residencyCommandBuffer);
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if (vkCreateFence(device, &fenceInfo, nullptr, &residencyFence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create texture residency fence");
+		}
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &residencyCommandBuffer;
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, residencyFence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit texture residency upload");
+		}
+	}
+
+	// The replacements are uploaded, the material sets pick them up a uniform slot at a time
+	void FinishResidencyUpload()
+	{
+		size_t replaced = 0;
+		for (size_t i = 0; i < residencyTextures.size(); ++i)
+		{
+			if (!residencyTextures[i].image)
+				continue;
+			retiredMips.push_back(RetiredTexture{ drawnTextures.textures[i], uniformSlotCount });
+			drawnTextures.textures[i] = residencyTextures[i];
+			drawnTextures.residency[i].residentLevel = residencyTextures[i].baseLevel;
+			++replaced;
+		}
+		residencyTextures.clear();
+		++drawnTextures.version;
+		ReleaseResidencyUpload();
+
+		VkDeviceSize resident = 0;
+		for (const GpuTexture& texture : drawnTextures.textures)
+			resident += gpuAllocator.GetAllocatedSize(texture.allocation);
+		std::cout << "Texture residency replaced " << replaced << " texture(s), " << resident << " of "
+			<< options.textureBudget << " budgeted bytes allocated" << std::endl;
+	}
+
+	// Staging buffer, command buffer & fence of the residency upload
+	void ReleaseResidencyUpload()
+	{
+		if (residencyCommandBuffer)
+		{
+			VkCommandPool commandPool;
+			vlk.GetCommandPool((void**)&commandPool);
+			vkFreeCommandBuffers(device, commandPool, 1, &residencyCommandBuffer);
+			residencyCommandBuffer = nullptr;
+		}
+		if (residencyFence)
+		{
+			vkDestroyFence(device, residencyFence, nullptr);
+			residencyFence = nullptr;
+		}
+		if (residencyStagingBuffer)
+			gpuAllocator.DestroyBuffer(residencyStagingBuffer, residencyStagingAllocation);
+	}
+
+	void CreateShaderModules()
+	{
+		GvkHelper::create_shader_module(device, vertexShaderSpirv.size() * sizeof(uint32_t), // load into Vulkan
+			reinterpret_cast<char*>(vertexShaderSpirv.data()), &vertexShader);
+		GvkHelper::create_shader_module(device, fragmentShaderSpirv.size() * sizeof(uint32_t),
+			reinterpret_cast<char*>(fragmentShaderSpirv.data()), &fragmentShader);
 	}
 
 	shaderc_compile_options_t CreateCompileOptions()
@@ -478,95 +1666,104 @@ private:
 		return retval;
 	}
 
-	void CompileVertexShader(const shaderc_compiler_t& compiler, const shaderc_compile_options_t& options)
+	// Must describe every option CreateCompileOptions sets, it is part of the SPIR-V cache key
+	std::string GetCompileOptionsKey()
 	{
-		std::string vertexShaderSource = ReadFileIntoString("../VertexShader.hlsl");
-
-		shaderc_compilation_result_t result = shaderc_compile_into_spv( // compile
-			compiler, vertexShaderSource.c_str(), vertexShaderSource.length(),
-			shaderc_vertex_shader, "main.vert", "main", options);
-
-		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
-		{
-			PrintLabeledDebugString("Vertex Shader Errors: \n", shaderc_result_get_error_message(result));
-			abort(); //Vertex shader failed to compile! 
-			return;
-		}
-
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &vertexShader);
-
-		shaderc_result_release(result); // done
+		std::string key = "hlsl;invert_y";
+#ifndef NDEBUG
+		key += ";debug_info";
+#endif
+		return key;
 	}
 
-	void CompileFragmentShader(const shaderc_compiler_t& compiler, const shaderc_compile_options_t& options)
+	// Loads SPIR-V from the shader cache, compiling (and caching) it with shaderc on a miss.
+	// Touches no Vulkan or renderer state so both stages can compile at the same time.
+	std::vector<uint32_t> CompileShaderSpirv(const FileRead& file, shaderc_shader_kind kind, const char* inputName,
+		const char* errorLabel)
 	{
-		std::string fragmentShaderSource = ReadFileIntoString("../FragmentShader.hlsl");
+		std::string cacheFolder = GetCacheSubFolder("shaders");
+		// compiled straight out of the mapping, a missing file compiles as empty and fails below
+		if (!file.view)
+			std::cout << "ERROR: File \"" << file.path << "\" Not Found!" << std::endl;
+		const char* source = file.view ? reinterpret_cast<const char*>(file.view->Data()) : "";
+		size_t sourceSize = file.view ? file.view->Size() : 0;
+		uint64_t key = GetShaderCacheKey(source, sourceSize, "main", static_cast<int>(kind), GetCompileOptionsKey());
+		std::string cachePath = GetShaderCachePath(cacheFolder, key);
+
+		std::vector<uint32_t> spirv;
+		if (!cacheFolder.empty() && ReadShaderCache(cachePath, key, spirv))
+			return spirv;
+
+		// Intialize runtime shader compiler HLSL -> SPIRV, one per task so compiles never share state
+		shaderc_compiler_t compiler = shaderc_compiler_initialize();
+		shaderc_compile_options_t options = CreateCompileOptions();
 
 		shaderc_compilation_result_t result = shaderc_compile_into_spv( // compile
-			compiler, fragmentShaderSource.c_str(), fragmentShaderSource.length(),
-			shaderc_fragment_shader, "main.frag", "main", options);
+			compiler, source, sourceSize,
+			kind, inputName, "main", options);
 
 		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
 		{
-			PrintLabeledDebugString("Fragment Shader Errors: \n", shaderc_result_get_error_message(result));
-			abort(); //Fragment shader failed to compile! 
-			return;
+			// thrown, not aborted: the startup task records it and WaitForStartupTasks rethrows it once joined
+			PrintLabeledDebugString(errorLabel, shaderc_result_get_error_message(result));
+			shaderc_result_release(result);
+			shaderc_compile_options_release(options);
+			shaderc_compiler_release(compiler);
+			throw std::runtime_error(std::string("\"") + file.path + "\" failed to compile");
 		}
 
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &fragmentShader);
+		if (!cacheFolder.empty() && !WriteShaderCache(cachePath, key, shaderc_result_get_bytes(result), shaderc_result_get_length(result)))
+		{
+			std::cout << "Shader cache \"" << cachePath << "\" could not be written" << std::endl;
+		}
 
+		spirv.resize(shaderc_result_get_length(result) / sizeof(uint32_t));
+		memcpy(spirv.data(), shaderc_result_get_bytes(result), spirv.size() * sizeof(uint32_t));
+
+		// Free runtime shader compiler resources
 		shaderc_result_release(result); // done
+		shaderc_compile_options_release(options);
+		shaderc_compiler_release(compiler);
+		return spirv;
 	}
 	
-	std::vector<VkVertexInputAttributeDescription> CreateVkVertexInputAttributeDescriptions()
+	std::vector<VkVertexInputAttributeDescription> CreateVkVertexInputAttributeDescriptions(uint32_t vertexFormat,
+		const PackedVertexLayout& vertexLayout)
 {
     std::vector<VkVertexInputAttributeDescription> attributeDescriptions(4);
+    bool quantized = vertexFormat == GEOMETRY_VERTEX_FORMAT_QUANTIZED;
 
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = 0;
-
-    attributeDescriptions[1].binding = 1;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = 0;
+    attributeDescriptions[0].format = quantized ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[1].format = quantized ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[2].format = quantized ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[3].format = quantized ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32A32_SFLOAT;
 
-    attributeDescriptions[2].binding = 2;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = 0;
-
-    attributeDescriptions[3].binding = 3;
-    attributeDescriptions[3].location = 3;
-    attributeDescriptions[3].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    attributeDescriptions[3].offset = 0;
+    // locations follow GEOMETRY_STREAM, the layout decides binding & offset
+    for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i)
+    {
+        attributeDescriptions[i].location = i;
+        attributeDescriptions[i].binding = vertexLayout.streamBinding[i];
+        attributeDescriptions[i].offset = vertexLayout.streamOffset[i];
+    }
 
     return attributeDescriptions;
 }
 
-	std::vector<VkVertexInputBindingDescription> CreateVkVertexInputBindingDescriptions() 
+	std::vector<VkVertexInputBindingDescription> CreateVkVertexInputBindingDescriptions(const PackedVertexLayout& vertexLayout)
 	{
-		std::vector<VkVertexInputBindingDescription> bindingDescriptions(4);
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions(vertexLayout.bindingCount);
 
-		for (int i = 0; i < 4; ++i)
+		for (uint32_t i = 0; i < vertexLayout.bindingCount; ++i)
 		{
 			bindingDescriptions[i].binding = i;
 			bindingDescriptions[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+			bindingDescriptions[i].stride = vertexLayout.bindingStrides[i];
 		}
 
-		// Set strides based on the accessor's byte stride
-		bindingDescriptions[0].stride = model.accessors[0].ByteStride(model.bufferViews[model.accessors[0].bufferView]);
-		bindingDescriptions[1].stride = model.accessors[1].ByteStride(model.bufferViews[model.accessors[1].bufferView]);
-		bindingDescriptions[2].stride = model.accessors[2].ByteStride(model.bufferViews[model.accessors[2].bufferView]);
-		bindingDescriptions[3].stride = model.accessors[3].ByteStride(model.bufferViews[model.accessors[3].bufferView]);
-
 		return bindingDescriptions;
 	}
-	// Create Pipeline & Layout (Thanks Tiny!)
-	void InitializeGraphicsPipeline()
+	// Create Pipeline & Layout (Thanks Tiny!), once per distinct vertex input state
+	VkPipeline GetGraphicsPipeline(uint32_t vertexFormat, const PackedVertexLayout& vertexLayout)
 	{
 		VkPipelineShaderStageCreateInfo stage_create_info[2] = {};
 
@@ -576,6 +1773,16 @@ private:
 		stage_create_info[0].module = vertexShader;
 		stage_create_info[0].pName = "main";
 
+		// QUANTIZED_VERTICES in VertexShader.hlsl picks how the attributes are decoded
+		int32_t quantizedVertices = vertexFormat == GEOMETRY_VERTEX_FORMAT_QUANTIZED ? 1 : 0;
+		VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(quantizedVertices) };
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = 1;
+		specializationInfo.pMapEntries = &specializationEntry;
+		specializationInfo.dataSize = sizeof(quantizedVertices);
+		specializationInfo.pData = &quantizedVertices;
+		stage_create_info[0].pSpecializationInfo = &specializationInfo;
+
 		// Create Stage Info for Fragment Shader
 		stage_create_info[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		stage_create_info[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -584,14 +1791,24 @@ private:
 
 
 		VkPipelineInputAssemblyStateCreateInfo assembly_create_info = CreateVkPipelineInputAssemblyStateCreateInfo();
-		auto vertex_binding_description = CreateVkVertexInputBindingDescriptions();
+		auto vertex_binding_description = CreateVkVertexInputBindingDescriptions(vertexLayout);
 
 
 		//vertex_binding_description.binding = 0;
 		//vertex_binding_description.stride = 3 * sizeof(float); // 3 floats for position (12 bytes)
 		//vertex_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-		auto attributeDescriptions = CreateVkVertexInputAttributeDescriptions();
+		auto attributeDescriptions = CreateVkVertexInputAttributeDescriptions(vertexFormat, vertexLayout);
+
+		// layouts that come out identical (e.g. interleaved & split for a position only model) share a pipeline
+		std::string pipelineKey(reinterpret_cast<const char*>(vertex_binding_description.data()),
+			vertex_binding_description.size() * sizeof(VkVertexInputBindingDescription));
+		pipelineKey.append(reinterpret_cast<const char*>(attributeDescriptions.data()),
+			attributeDescriptions.size() * sizeof(VkVertexInputAttributeDescription));
+		pipelineKey.append(reinterpret_cast<const char*>(&quantizedVertices), sizeof(quantizedVertices));
+		auto existing = pipelines.find(pipelineKey);
+		if (existing != pipelines.end())
+			return existing->second;
 
 
 		/*VkVertexInputAttributeDescription vertex_attribute_descriptions[1];
@@ -622,8 +1839,6 @@ private:
 
 
 
-		CreatePipelineLayout();
-
 		// Pipeline State... (FINALLY) 
 		VkGraphicsPipelineCreateInfo pipeline_create_info = {};
 		pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -642,7 +1857,15 @@ private:
 		pipeline_create_info.subpass = 0;
 		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
 
-		vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &pipeline);
+		VkPipeline pipeline;
+		if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipeline_create_info, nullptr, &pipeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create graphics pipeline");
+		}
+		pipelines[pipelineKey] = pipeline;
+		std::cout << "Created pipeline " << pipelines.size() << " (" << vertex_binding_description.size()
+			<< " binding(s), " << (quantizedVertices ? "quantized" : "float") << " vertices)" << std::endl;
+		return pipeline;
 	}
 
 	VkPipelineShaderStageCreateInfo CreateVertexShaderStageCreateInfo()
@@ -793,15 +2016,31 @@ private:
 		return retval;
 	}
 
+	void CreatePipelineCache()
+	{
+		std::string cacheFolder = GetCacheSubFolder("pipelines");
+		pipelineCachePath = cacheFolder.empty() ? std::string() : cacheFolder + "pipeline_cache.bin";
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		pipelineCache = LoadPipelineCache(device, properties, pipelineCachePath);
+	}
+
 	void CreatePipelineLayout()
 	{
 
 		VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
 		pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipeline_layout_create_info.setLayoutCount = 1;
-		pipeline_layout_create_info.pSetLayouts = &descriptorSetLayout;
-		pipeline_layout_create_info.pushConstantRangeCount = 0;
-		pipeline_layout_create_info.pPushConstantRanges = nullptr;
+		VkDescriptorSetLayout setLayouts[2] = { descriptorSetLayout, materialSetLayout };
+		pipeline_layout_create_info.setLayoutCount = 2;
+		pipeline_layout_create_info.pSetLayouts = setLayouts;
+		// each draw pushes its world matrix, dequantization and material factors
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(MESH_VARS);
+		pipeline_layout_create_info.pushConstantRangeCount = 1;
+		pipeline_layout_create_info.pPushConstantRanges = &pushConstantRange;
 
 		vkCreatePipelineLayout(device, &pipeline_layout_create_info, nullptr, &pipelineLayout);
 	}
@@ -820,6 +2059,11 @@ private:
 public:
 	void Render()
 	{
+		UpdateModelStream();
+		// switching layouts replaces buffers, so it happens before this frame records anything that uses them
+		if (benchmarkLayout >= 0 && benchmarkFrame == LAYOUT_BENCHMARK_FRAMES)
+			FinishLayoutBenchmarkPhase();
+
 		VkCommandBuffer commandBuffer = GetCurrentCommandBuffer();
 		SetUpPipeline(commandBuffer);
 
@@ -829,25 +2073,49 @@ public:
 		}
 
 		viewMatrix = FreeLookCamera(win, viewMatrix); 
-		UpdateUniformBuffer(currentImageIndex);
+		uint32_t uniformOffset = UpdateUniformBuffer(currentImageIndex);
+		UpdateTextureResidency();
+
+		// this slot's last frame is done, so its material sets can take the textures residency swapped in since
+		uint32_t slot = currentImageIndex % uniformSlotCount;
+		if (drawnTextures.materialCount && drawnTextures.slotVersions[slot] != drawnTextures.version)
+			WriteMaterialSets(source->materialImages, drawnTextures, slot);
 	
-		//UpdateDescriptorSet();
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentImageIndex], 0, nullptr);
-		VkDeviceSize offsets[] = { vertexBufferOffset };
-		//VkDeviceSize vertexBufferOffset = 8; // Vertex data starts at byte offset 8 in the unified buffer
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &unifiedBufferHandle, offsets);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 1, &uniformOffset);
 
 		// Bind the unified buffer as index buffer
 		//VkDeviceSize indexBufferOffset = 0; // Index data starts at byte offset 0 in the unified buffer
-		vkCmdBindIndexBuffer(commandBuffer, unifiedBufferHandle, indexBufferOffset, VK_INDEX_TYPE_UINT16);
+		uint32_t boundIndexSize = 0; // each draw selects the 16 or 32-bit section, rebound only when it changes
+		VkDescriptorSet boundMaterialSet = nullptr; // likewise for the material's textures
 
-		// Use vkCmdDrawIndexed to draw the mesh
-		 
-		//std::cout << indexCount << "    " << indexBufferOffset <<	vertexBufferOffset	<<  std::endl;
+		if (benchmarkLayout >= 0)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, benchmarkFrame * 2);
 
+		// One draw per primitive instance, all out of the same pool so nothing is rebound in between
+		for (size_t i = 0; i < drawnBuffer.draws.size(); ++i)
+		{
+			const GeometryDraw& draw = drawnBuffer.draws[i];
+			if (draw.indexSize != boundIndexSize)
+			{
+				bool wide = draw.indexSize == sizeof(uint32_t);
+				vkCmdBindIndexBuffer(commandBuffer, drawnBuffer.buffer, wide ? drawnBuffer.wideIndexOffset : drawnBuffer.indexOffset,
+					wide ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16);
+				boundIndexSize = draw.indexSize;
+			}
+			VkDescriptorSet materialSet = draw.material >= 0 && static_cast<uint32_t>(draw.material) < drawnTextures.materialCount ?
+				drawnTextures.materialSets[slot * drawnTextures.materialCount + draw.material] : defaultMaterialSet;
+			if (materialSet != boundMaterialSet)
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &materialSet, 0, nullptr);
+				boundMaterialSet = materialSet;
+			}
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+				sizeof(MESH_VARS), &drawnBuffer.drawConstants[i]);
+			vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+		}
 
-		//uint32_t indexCount = 3; // Number of indices from GLTF accessor
-		vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+		if (benchmarkLayout >= 0)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, benchmarkFrame++ * 2 + 1);
 		//vkCmdDraw(commandBuffer, 3, 1, 0, 0); 
 	}
 
@@ -868,7 +2136,7 @@ private:
 		UpdateWindowDimensions();
 		SetViewport(commandBuffer);
 		SetScissor(commandBuffer);
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawnBuffer.pipeline);
 		BindVertexBuffers(commandBuffer);
 	}
 
@@ -892,32 +2160,146 @@ private:
 
 	void BindVertexBuffers(VkCommandBuffer& commandBuffer)
 	{
-		std::vector<VkBuffer> buffers(4, unifiedBufferHandle);
-		vkCmdBindVertexBuffers(commandBuffer, 0, 4, buffers.data(), attributeOffsets.data());
+		std::vector<VkBuffer> buffers(drawnBuffer.bindingOffsets.size(), drawnBuffer.buffer);
+		vkCmdBindVertexBuffers(commandBuffer, 0, static_cast<uint32_t>(buffers.size()), buffers.data(),
+			drawnBuffer.bindingOffsets.data());
+	}
+
+	// Rebuilds the geometry buffer for another layout and picks its pipeline, only ever while the GPU is idle
+	void SwitchVertexLayout(VERTEX_LAYOUT layout)
+	{
+		if (layout == activeLayout)
+			return;
+		if (sourceReleased)
+			throw std::runtime_error("The vertex layout can't change once the source data was released");
+		vkDeviceWaitIdle(device);
+		DestroyGeometryBuffer(drawnBuffer);
+		activeLayout = layout;
+		UploadGeometryBuffer(source->geometry, activeLayout, drawnBuffer);
+		drawnBuffer.pipeline = GetGraphicsPipeline(source->geometry.vertexFormat, drawnBuffer.layout);
+		PrintGeometryBuffer(source->geometry, drawnBuffer);
+	}
+
+	void StartLayoutBenchmark()
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		if (!properties.limits.timestampComputeAndGraphics)
+		{
+			std::cout << "Layout benchmark skipped, the device has no graphics timestamps" << std::endl;
+			return;
+		}
+		timestampPeriod = properties.limits.timestampPeriod;
+
+		VkQueryPoolCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		createInfo.queryCount = LAYOUT_BENCHMARK_FRAMES * 2;
+		if (vkCreateQueryPool(device, &createInfo, nullptr, &timestampPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create timestamp query pool");
+		}
+		StartLayoutBenchmarkPhase(VERTEX_LAYOUT_SEPARATE);
+	}
+
+	void StartLayoutBenchmarkPhase(VERTEX_LAYOUT layout)
+	{
+		SwitchVertexLayout(layout);
+
+		// queries may only be reset outside a render pass, frames are recorded inside one
+		VkCommandPool commandPool;
+		VkQueue graphicsQueue;
+		vlk.GetCommandPool((void**)&commandPool);
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+		VkCommandBuffer commandBuffer;
+		GvkHelper::signal_command_start(device, commandPool, &commandBuffer);
+		vkCmdResetQueryPool(commandBuffer, timestampPool, 0, LAYOUT_BENCHMARK_FRAMES * 2);
+		GvkHelper::signal_command_end(device, graphicsQueue, commandPool, &commandBuffer);
+
+		benchmarkLayout = layout;
+		benchmarkFrame = 0;
+	}
+
+	// Averages the phase that just ended, then moves on to the next layout or reports all of them
+	void FinishLayoutBenchmarkPhase()
+	{
+		std::vector<uint64_t> timestamps(LAYOUT_BENCHMARK_FRAMES * 2);
+		vkGetQueryPoolResults(device, timestampPool, 0, LAYOUT_BENCHMARK_FRAMES * 2, timestamps.size() * sizeof(uint64_t),
+			timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+		double total = 0;
+		for (unsigned int i = LAYOUT_BENCHMARK_WARMUP; i < LAYOUT_BENCHMARK_FRAMES; ++i)
+			total += double(timestamps[i * 2 + 1] - timestamps[i * 2]) * timestampPeriod;
+		benchmarkResults[benchmarkLayout] = total / (LAYOUT_BENCHMARK_FRAMES - LAYOUT_BENCHMARK_WARMUP) / 1e6;
+
+		if (benchmarkLayout + 1 < VERTEX_LAYOUT_COUNT)
+		{
+			StartLayoutBenchmarkPhase(static_cast<VERTEX_LAYOUT>(benchmarkLayout + 1));
+			return;
+		}
+
+		const SceneGeometry& geometry = source->geometry;
+		std::cout << "Layout benchmark (GPU time of the draws, " << geometry.indexCount / 3 << " triangles, "
+			<< geometry.vertexCount << " vertices):" << std::endl;
+		for (int i = 0; i < VERTEX_LAYOUT_COUNT; ++i)
+		{
+			PackedVertexLayout packed = GetPackedVertexLayout(geometry, static_cast<VERTEX_LAYOUT>(i));
+			std::cout << "  " << VERTEX_LAYOUT_NAMES[i] << ": " << benchmarkResults[i] << " ms, "
+				<< packed.bindingCount << " binding(s)" << std::endl;
+		}
+		benchmarkLayout = -1;
+		SwitchVertexLayout(options.vertexLayout);
+		if (options.releaseSourceData)
+			ReleaseSourceData();
 	}
 
 	//Cleanup callback function (passed to VKSurface, will be called when the pipeline shuts down)
 	void CleanUp()
 	{
+		// a model still streaming in is joined first, its thread may be writing the staging buffer
+		JoinStreamTask();
 		// wait till everything has completed
 		vkDeviceWaitIdle(device);
 
 		// Release allocated buffers, shaders & pipeline
-		vkDestroyBuffer(device, unifiedBufferHandle, nullptr);
-		vkFreeMemory(device, unifiedBufferData, nullptr);
-
-		for (size_t i = 0; i < uniformBuffers.size(); i++)
-		{
-			vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-			vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-		}
+		ReleaseModelUpload();
+		ReleaseResidencyUpload();
+		for (GpuTexture& texture : residencyTextures)
+			DestroyTexture(texture);
+		for (RetiredTexture& retired : retiredMips)
+			DestroyTexture(retired.texture);
+		DiscardStreamedBuffer();
+		DestroyGeometryBuffer(retiredBuffer);
+		DestroyGeometryBuffer(drawnBuffer);
+		DestroyMaterialTextures(streamedTextures);
+		DestroyMaterialTextures(retiredTextures);
+		DestroyMaterialTextures(drawnTextures);
+		DestroyTexture(defaultTexture);
+		gpuAllocator.DestroyBuffer(uniformBuffer, uniformBufferAllocation);
+		gpuAllocator.PrintStats(); // anything still allocated here has leaked
+		if (timestampPool)
+			vkDestroyQueryPool(device, timestampPool, nullptr);
+		gpuAllocator.Destroy();
 
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-		// TODO: Part 2f
+		vkDestroyDescriptorSetLayout(device, materialSetLayout, nullptr);
+		vkDestroySampler(device, textureSampler, nullptr);
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 		vkDestroyShaderModule(device, vertexShader, nullptr);
 		vkDestroyShaderModule(device, fragmentShader, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-		vkDestroyPipeline(device, pipeline, nullptr);
+		for (auto& entry : pipelines)
+			vkDestroyPipeline(device, entry.second, nullptr);
+		pipelines.clear();
+
+		// everything the driver compiled this run is kept for the next launch
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		if (!pipelineCachePath.empty() && !SavePipelineCache(device, properties, pipelineCache, pipelineCachePath))
+			std::cout << "Pipeline cache \"" << pipelineCachePath << "\" could not be written" << std::endl;
+		vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+		streamSource.reset();
+		source.reset();
 	}
 };